@@ -20,161 +20,6076 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <deque>
+#include <forward_list>
+#include <list>
+#include <mutex>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <numeric>
 #include <random>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
 #include <vector>
 #include <thread>
+#include <future>
+#include <utility>
+#include <exception>
+#if __has_include(<execution>)
+#include <execution>
+#endif
+#include <fstream>
 #include <iostream>
 #include <algorithm>
+#include <type_traits>
+#include <functional>
+#include <condition_variable>
+#if __cplusplus > 201703L && __has_include(<span>)
+#include <span>
+#endif
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define QUICKSORT_HAS_COROUTINES 1
+#include <coroutine>
+#endif
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if __has_include(<sys/mman.h>) && __has_include(<unistd.h>)
+#define QUICKSORT_HAS_MMAP 1
+#include <cerrno>
+#include <cstdio>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace detail
 {
 
+#ifndef QUICKSORT_SMALL_INSTANCE_THRESHOLD
+#define QUICKSORT_SMALL_INSTANCE_THRESHOLD 24
+#endif
+
+// Subranges up to this size are finished without further partitioning.
+// Fixed at compile time: every engine uses it, none takes it per call.
+constexpr std::ptrdiff_t small_instance_threshold = QUICKSORT_SMALL_INSTANCE_THRESHOLD;
+
+// Largest size served by a sorting network instead of insertion sort.
+constexpr std::size_t sorting_network_limit = 16;
+
+// Instrumentation hooks, called unqualified with the sort's comparator so
+// that instrument::counting can pick them up through ADL. For any other
+// comparator they are empty and compile away.
+template<typename Cmp>
+void note_moves(const Cmp&, std::size_t)
+{
+}
+
+template<typename Cmp>
+void note_swaps(const Cmp&, std::size_t)
+{
+}
+
+// start_step is taken before a partition step and handed to note_partition
+// once it is done, so instrumented comparators can time every level.
+struct untimed_step
+{
+};
+
+template<typename Cmp>
+untimed_step start_step(const Cmp&)
+{
+    return {};
+}
+
+template<typename Cmp, typename Started>
+void note_partition(const Cmp&, std::size_t, std::ptrdiff_t, std::ptrdiff_t, const Started&)
+{
+}
+
 template<typename It, typename Cmp>
 void insertion_sort(It first, It last, Cmp cmp)
 {
-    for (auto begin = first; begin != last; ++begin)
+    if (first == last)
+        return;
+
+    for (auto begin = std::next(first); begin != last; ++begin)
+    {
+        auto prev = std::prev(begin);
+        if (!cmp(*begin, *prev))
+            continue;
+
+        typename std::iterator_traits<It>::value_type value = std::move(*begin);
+        auto hole = begin;
+        std::size_t moves = 2;
+        do
+        {
+            *hole = std::move(*prev);
+            hole = prev;
+            ++moves;
+        } while (hole != first && cmp(value, *--prev));
+
+        *hole = std::move(value);
+        note_moves(cmp, moves);
+    }
+}
+
+template<typename It>
+void insertion_sort(It first, It last)
+{
+    insertion_sort(first, last, std::less<>());
+}
+
+// Elements partial_insertion_sort may move before it gives up.
+constexpr std::ptrdiff_t partial_insertion_limit = 8;
+
+// Insertion sort that bails out once more than partial_insertion_limit
+// elements had to be moved. Returns whether the range ended up sorted.
+template<typename It, typename Cmp>
+bool partial_insertion_sort(It first, It last, Cmp& cmp)
+{
+    if (first == last)
+        return true;
+
+    std::ptrdiff_t moved = 0;
+    for (auto begin = std::next(first); begin != last; ++begin)
+    {
+        auto prev = std::prev(begin);
+        if (!cmp(*begin, *prev))
+            continue;
+
+        typename std::iterator_traits<It>::value_type value = std::move(*begin);
+        auto hole = begin;
+        do
+        {
+            *hole = std::move(*prev);
+            hole = prev;
+            ++moved;
+        } while (hole != first && cmp(value, *--prev));
+
+        *hole = std::move(value);
+        if (moved > partial_insertion_limit)
+            return std::next(begin) == last;
+    }
+    return true;
+}
+
+struct comparator
+{
+    unsigned char a;
+    unsigned char b;
+};
+
+// Batcher's odd-even merge network restricted to n wires. Comparators that
+// touch a wire >= n are dropped, which is equivalent to padding with +inf.
+template<typename Emit>
+constexpr void batcher_network(std::size_t n, Emit emit)
+{
+    for (std::size_t p = 1; p < n; p += p)
+        for (std::size_t k = p; k > 0; k /= 2)
+            for (std::size_t j = k % p; j + k < n; j += k + k)
+                for (std::size_t i = 0; i < k && i + j + k < n; ++i)
+                    if ((i + j) / (p + p) == (i + j + k) / (p + p))
+                        emit(i + j, i + j + k);
+}
+
+template<std::size_t N>
+struct sorting_network
+{
+    static constexpr std::size_t count()
+    {
+        std::size_t result = 0;
+        batcher_network(N, [&result](std::size_t, std::size_t) { ++result; });
+        return result;
+    }
+
+    static constexpr std::array<comparator, count()> comparators()
+    {
+        std::array<comparator, count()> result{};
+        std::size_t index = 0;
+        batcher_network(N, [&](std::size_t a, std::size_t b) {
+            result[index++] = comparator{static_cast<unsigned char>(a), static_cast<unsigned char>(b)};
+        });
+        return result;
+    }
+
+    static constexpr auto network = comparators();
+};
+
+// Arithmetic types are written so that they compile down to min/max or
+// cmov, anything else is swapped by moves. Usable in constant expressions.
+template<typename RandomIt, typename Cmp>
+constexpr void compare_exchange(RandomIt a, RandomIt b, Cmp& cmp)
+{
+    using value_type = typename std::iterator_traits<RandomIt>::value_type;
+    if constexpr (std::is_arithmetic<value_type>::value)
+    {
+        const value_type x = *a;
+        const value_type y = *b;
+        const bool swap = cmp(y, x);
+        *a = swap ? y : x;
+        *b = swap ? x : y;
+    }
+    else if (cmp(*b, *a))
+    {
+        value_type tmp = std::move(*a);
+        *a = std::move(*b);
+        *b = std::move(tmp);
+    }
+}
+
+template<std::size_t N, typename RandomIt, typename Cmp, std::size_t... I>
+constexpr void apply_sorting_network([[maybe_unused]] RandomIt first, [[maybe_unused]] Cmp& cmp, std::index_sequence<I...>)
+{
+    constexpr auto& network = sorting_network<N>::network;
+    (compare_exchange(first + network[I].a, first + network[I].b, cmp), ...);
+}
+
+template<std::size_t N, typename RandomIt, typename Cmp>
+constexpr void network_sort(RandomIt first, Cmp& cmp)
+{
+    apply_sorting_network<N>(first, cmp, std::make_index_sequence<sorting_network<N>::network.size()>());
+}
+
+template<typename RandomIt, typename Cmp, std::size_t... N>
+void network_sort(RandomIt first, std::size_t n, Cmp& cmp, std::index_sequence<N...>)
+{
+    using sorter = void (*)(RandomIt, Cmp&);
+    static constexpr sorter sorters[] = {&network_sort<N, RandomIt, Cmp>...};
+    sorters[n](first, cmp);
+}
+
+template<typename It>
+constexpr bool use_sorting_network = std::is_arithmetic<typename std::iterator_traits<It>::value_type>::value
+    && std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<It>::iterator_category>::value;
+
+// Finishes ranges up to threshold elements and reports whether it did.
+// The engines always pass the default.
+template<typename It, typename Cmp = std::less<>>
+bool sort_small_instances(It first, It last, Cmp cmp = Cmp{}, std::ptrdiff_t threshold = small_instance_threshold)
+{
+    const auto size = std::distance(first, last);
+    if (size > std::max<std::ptrdiff_t>(threshold, 1))
+        return false;
+
+    if constexpr (use_sorting_network<It>)
+    {
+        if (static_cast<std::size_t>(size) <= sorting_network_limit)
+        {
+            network_sort(first, static_cast<std::size_t>(size), cmp, std::make_index_sequence<sorting_network_limit + 1>());
+            return true;
+        }
+    }
+
+    insertion_sort(first, last, cmp);
+    return true;
+}
+
+// xorshift64*: eight bytes of state, a handful of instructions per draw.
+class xorshift64star
+{
+public:
+    using result_type = std::uint64_t;
+
+    explicit xorshift64star(std::uint64_t seed)
+        : state_(seed ? seed : 0x9e3779b97f4a7c15ull)
+    {
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~result_type(0); }
+
+    result_type operator()()
+    {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 0x2545f4914f6cdd1dull;
+    }
+
+private:
+    std::uint64_t state_;
+};
+
+inline xorshift64star& thread_rng()
+{
+    thread_local xorshift64star rng([]() {
+        std::random_device rd;
+        return (std::uint64_t(rd()) << 32) ^ rd() ^ std::hash<std::thread::id>()(std::this_thread::get_id());
+    }());
+    return rng;
+}
+
+template<typename RandomGenerator>
+constexpr bool is_full_range_generator = RandomGenerator::min() == 0
+    && (RandomGenerator::max() == 0xffffffffull || RandomGenerator::max() == ~0ull);
+
+#if defined(__SIZEOF_INT128__)
+// __extension__ keeps -Wpedantic builds quiet about the non-standard type.
+__extension__ using uint128 = unsigned __int128;
+#endif
+
+// Uniform draw from [0, n) after Lemire, "Fast Random Integer Generation in
+// an Interval": a multiply and a shift, a division only on rejection. Other
+// generators go through uniform_int_distribution.
+template<typename RandomGenerator, typename Size>
+Size bounded_random(RandomGenerator& g, Size n)
+{
+    if constexpr (is_full_range_generator<RandomGenerator>)
+    {
+        constexpr bool wide = RandomGenerator::max() > 0xffffffffull;
+
+        if (static_cast<std::uint64_t>(n) <= 0xffffffffull)
+        {
+            const auto range = static_cast<std::uint32_t>(n);
+            auto draw = [&g]() {
+                return static_cast<std::uint32_t>(wide ? std::uint64_t(g()) >> 32 : std::uint64_t(g()));
+            };
+
+            auto m = std::uint64_t(draw()) * range;
+            if (static_cast<std::uint32_t>(m) < range)
+            {
+                const std::uint32_t threshold = (0u - range) % range;
+                while (static_cast<std::uint32_t>(m) < threshold)
+                    m = std::uint64_t(draw()) * range;
+            }
+            return static_cast<Size>(m >> 32);
+        }
+#if defined(__SIZEOF_INT128__)
+        if constexpr (wide)
+        {
+            const auto range = static_cast<std::uint64_t>(n);
+            auto m = static_cast<uint128>(g()) * range;
+            if (static_cast<std::uint64_t>(m) < range)
+            {
+                const std::uint64_t threshold = (0ull - range) % range;
+                while (static_cast<std::uint64_t>(m) < threshold)
+                    m = static_cast<uint128>(g()) * range;
+            }
+            return static_cast<Size>(m >> 64);
+        }
+#endif
+    }
+
+    std::uniform_int_distribution<Size> dis(0, n - 1);
+    return dis(g);
+}
+
+} // namespace detail
+
+namespace pivot
+{
+
+template<typename It, typename RandomGenerator>
+It random(It first, It last, RandomGenerator& g)
+{
+    std::advance(first, detail::bounded_random(g, std::distance(first, last)));
+    return first;
+}
+
+// Draws from a per-thread generator, so concurrent sorts neither race nor
+// share generator state between cores.
+template<typename It>
+It random(It first, It last)
+{
+    return random(first, last, detail::thread_rng());
+}
+
+template<typename It>
+It median(It first, It last)
+{
+    return std::next(first, std::distance(first,last)/2);
+}
+
+// The policies below compare elements, so the sorts hand them the comparator
+// as a third argument. Called with two arguments they fall back to
+// std::less<>, which keeps them usable wherever a Pivot_func is expected.
+
+template<typename It, typename Cmp>
+It median_of(It a, It b, It c, Cmp& cmp)
+{
+    if (cmp(*a, *b))
+    {
+        if (cmp(*b, *c))
+            return b;
+        return cmp(*a, *c) ? c : a;
+    }
+
+    if (cmp(*a, *c))
+        return a;
+    return cmp(*b, *c) ? c : b;
+}
+
+// Median of the first, middle and last element.
+struct median_of_three
+{
+    template<typename It, typename Cmp = std::less<>>
+    It operator()(It first, It last, Cmp cmp = Cmp{}) const
+    {
+        const auto size = std::distance(first, last);
+        if (size < 3)
+            return first;
+
+        return median_of(first, std::next(first, size / 2), std::next(first, size - 1), cmp);
+    }
+};
+
+// Tukey's ninther: median of the medians of three evenly spaced triples.
+// Small ranges use a plain median of three.
+struct ninther
+{
+    static constexpr std::ptrdiff_t min_size = 128;
+
+    template<typename It, typename Cmp = std::less<>>
+    It operator()(It first, It last, Cmp cmp = Cmp{}) const
+    {
+        const auto size = std::distance(first, last);
+        if (size < min_size)
+            return median_of_three()(first, last, cmp);
+
+        const auto step = size / 8;
+        const auto mid = std::next(first, size / 2);
+        const auto back = std::next(first, size - 1);
+
+        return median_of(median_of(first, std::next(first, step), std::next(first, 2 * step), cmp),
+                         median_of(std::prev(mid, step), mid, std::next(mid, step), cmp),
+                         median_of(std::prev(back, 2 * step), std::prev(back, step), back, cmp),
+                         cmp);
+    }
+};
+
+// Median of k evenly spaced samples, k is rounded up to an odd number and
+// capped at max_samples.
+class sample_median
+{
+public:
+    static constexpr std::size_t max_samples = 63;
+
+    explicit sample_median(std::size_t k = 15)
+        : k_(std::min(k | 1, max_samples))
+    {
+    }
+
+    template<typename It, typename Cmp = std::less<>>
+    It operator()(It first, It last, Cmp cmp = Cmp{}) const
+    {
+        const auto size = static_cast<std::size_t>(std::distance(first, last));
+        if (size < 2 * k_)
+            return median_of_three()(first, last, cmp);
+
+        std::array<It, max_samples> samples;
+        const auto step = size / k_;
+        auto it = std::next(first, static_cast<std::ptrdiff_t>(step / 2));
+        for (std::size_t i = 0; i < k_; ++i)
+        {
+            samples[i] = it;
+            if (i + 1 < k_)
+                std::advance(it, static_cast<std::ptrdiff_t>(step));
+        }
+
+        const auto mid = samples.begin() + k_ / 2;
+        std::nth_element(samples.begin(), mid, samples.begin() + k_, [&cmp](It a, It b) {
+            return cmp(*a, *b);
+        });
+        return *mid;
+    }
+
+private:
+    std::size_t k_;
+};
+
+} // namespace pivot
+
+namespace parallel
+{
+
+// Activity of a pool's workers since construction or the last reset. Only
+// collected when QUICKSORT_POOL_STATISTICS is defined, all zero otherwise.
+struct pool_statistics
+{
+    std::uint64_t tasks = 0;   // tasks run
+    std::uint64_t steals = 0;  // tasks taken from another worker's deque
+    std::uint64_t busy_ns = 0; // time spent in tasks, helping included
+    std::uint64_t idle_ns = 0; // time workers spent asleep
+};
+
+// Work-stealing pool: every worker owns a deque, pushes and pops its own work
+// at the back (LIFO, cache friendly) and steals the oldest - usually largest -
+// subranges from the front of the other deques when it runs dry.
+class thread_pool
+{
+public:
+    using task = std::function<void()>;
+
+    // on_start(i), if given, runs on worker i before it takes any task, e.g.
+    // to set its CPU affinity.
+    explicit thread_pool(std::size_t workers = std::max(1u, std::thread::hardware_concurrency()),
+                         std::function<void(std::size_t)> on_start = {})
+    {
+        workers = std::max<std::size_t>(workers, 1);
+        for (std::size_t i = 0; i < workers; ++i)
+            queues_.push_back(std::make_unique<work_queue>());
+
+        for (std::size_t i = 0; i < workers; ++i)
+        {
+            threads_.emplace_back([this, i, on_start]() {
+                if (on_start)
+                    on_start(i);
+                worker_loop(i);
+            });
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            done_ = true;
+        }
+        sleep_cv_.notify_all();
+
+        for (auto& t : threads_)
+            t.join();
+    }
+
+    std::size_t size() const
+    {
+        return threads_.size();
+    }
+
+    pool_statistics statistics() const
+    {
+        pool_statistics result;
+#ifdef QUICKSORT_POOL_STATISTICS
+        for (const auto& queue : queues_)
+        {
+            result.tasks += queue->tasks_run.load(std::memory_order_relaxed);
+            result.steals += queue->steals.load(std::memory_order_relaxed);
+            result.busy_ns += queue->busy_ns.load(std::memory_order_relaxed);
+            result.idle_ns += queue->idle_ns.load(std::memory_order_relaxed);
+        }
+#endif
+        return result;
+    }
+
+    void reset_statistics()
+    {
+#ifdef QUICKSORT_POOL_STATISTICS
+        for (auto& queue : queues_)
+        {
+            queue->tasks_run.store(0, std::memory_order_relaxed);
+            queue->steals.store(0, std::memory_order_relaxed);
+            queue->busy_ns.store(0, std::memory_order_relaxed);
+            queue->idle_ns.store(0, std::memory_order_relaxed);
+        }
+#endif
+    }
+
+    // Called from a worker of this pool the task lands on the worker's own
+    // deque, otherwise the deques are fed round-robin.
+    void submit(task t)
+    {
+        const auto index = current_pool == this
+            ? current_index
+            : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+
+        {
+            std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+            queues_[index]->tasks.push_back(std::move(t));
+        }
+        pending_.fetch_add(1, std::memory_order_release);
+
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+        }
+        sleep_cv_.notify_one();
+    }
+
+    // Runs one queued task on the calling thread, returns false if there was
+    // nothing to do. Used by waiting threads to help instead of blocking.
+    bool run_pending_task()
+    {
+        task t;
+        const auto index = current_pool == this ? current_index : 0;
+
+        if (!(current_pool == this && pop_local(index, t)) && !steal(index, t))
+            return false;
+
+#ifdef QUICKSORT_POOL_STATISTICS
+        // tasks run while helping inside another task count towards that one
+        const bool outermost = !in_task;
+        const auto start = std::chrono::steady_clock::now();
+        in_task = true;
+        t();
+        in_task = !outermost;
+        queues_[index]->tasks_run.fetch_add(1, std::memory_order_relaxed);
+        if (outermost)
+            queues_[index]->busy_ns.fetch_add(elapsed_ns(start), std::memory_order_relaxed);
+#else
+        t();
+#endif
+        return true;
+    }
+
+private:
+    struct work_queue
+    {
+        std::mutex mutex;
+        std::deque<task> tasks;
+#ifdef QUICKSORT_POOL_STATISTICS
+        std::atomic<std::uint64_t> tasks_run{0};
+        std::atomic<std::uint64_t> steals{0};
+        std::atomic<std::uint64_t> busy_ns{0};
+        std::atomic<std::uint64_t> idle_ns{0};
+#endif
+    };
+
+#ifdef QUICKSORT_POOL_STATISTICS
+    static std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point start)
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    static inline thread_local bool in_task = false;
+#endif
+
+    void worker_loop(std::size_t index)
+    {
+        current_pool = this;
+        current_index = index;
+
+        while (true)
+        {
+            if (run_pending_task())
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+#ifdef QUICKSORT_POOL_STATISTICS
+            const auto start = std::chrono::steady_clock::now();
+#endif
+            sleep_cv_.wait(lock, [this]() {
+                return done_ || pending_.load(std::memory_order_acquire) > 0;
+            });
+#ifdef QUICKSORT_POOL_STATISTICS
+            queues_[index]->idle_ns.fetch_add(elapsed_ns(start), std::memory_order_relaxed);
+#endif
+
+            if (done_ && pending_.load(std::memory_order_acquire) == 0)
+                return;
+        }
+    }
+
+    bool pop_local(std::size_t index, task& t)
+    {
+        auto& queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            return false;
+
+        t = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool steal(std::size_t thief, task& t)
+    {
+        for (std::size_t i = 0; i < queues_.size(); ++i)
+        {
+            auto& queue = *queues_[(thief + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+
+            t = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+#ifdef QUICKSORT_POOL_STATISTICS
+            if (i > 0)
+                queues_[thief]->steals.fetch_add(1, std::memory_order_relaxed);
+#endif
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<work_queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<std::size_t> pending_{0};
+    std::atomic<std::size_t> next_queue_{0};
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+    bool done_ = false;
+
+    static inline thread_local thread_pool* current_pool = nullptr;
+    static inline thread_local std::size_t current_index = 0;
+};
+
+// Fork-join scope on top of a pool. wait() keeps the calling thread busy with
+// queued tasks until every task started through this group has finished.
+class task_group
+{
+public:
+    explicit task_group(thread_pool& pool) : pool_(pool) {}
+
+    task_group(const task_group&) = delete;
+    task_group& operator=(const task_group&) = delete;
+
+    ~task_group()
+    {
+        wait_for_tasks();
+    }
+
+    thread_pool& pool() const
+    {
+        return pool_;
+    }
+
+    template<typename Func>
+    void run(Func func)
+    {
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        pool_.submit([this, func]() mutable {
+            try
+            {
+                func();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex_);
+                if (!error_)
+                    error_ = std::current_exception();
+            }
+            outstanding_.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    void wait()
+    {
+        wait_for_tasks();
+
+        if (error_)
+            std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+
+private:
+    void wait_for_tasks()
+    {
+        while (outstanding_.load(std::memory_order_acquire) > 0)
+        {
+            if (!pool_.run_pending_task())
+                std::this_thread::yield();
+        }
+    }
+
+    thread_pool& pool_;
+    std::atomic<std::size_t> outstanding_{0};
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+};
+
+// When the parallel sorts stop splitting work. Subranges below grain_size are
+// finished by the thread that holds them, and workers caps the number of
+// threads a sort may occupy (0: the pool size, or the hardware concurrency
+// for the thread-per-fork sort).
+struct cutoff_policy
+{
+    std::ptrdiff_t grain_size = 1 << 12;
+    std::size_t workers = 0;
+};
+
+// C++17 stand-in for std::stop_source / std::stop_token, for the async
+// sorts. Tokens are cheap to copy and share the source's flag; a default
+// constructed token is never stopped. The async sorts accept any type with
+// a stop_requested() member, std::stop_token included.
+class stop_token
+{
+public:
+    stop_token() = default;
+
+    bool stop_requested() const
+    {
+        return flag_ && flag_->load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class stop_source;
+
+    explicit stop_token(std::shared_ptr<std::atomic<bool>> flag) : flag_(std::move(flag)) {}
+
+    std::shared_ptr<std::atomic<bool>> flag_;
+};
+
+class stop_source
+{
+public:
+    stop_token get_token() const
+    {
+        return stop_token(flag_);
+    }
+
+    void request_stop()
+    {
+        flag_->store(true, std::memory_order_relaxed);
+    }
+
+    bool stop_requested() const
+    {
+        return flag_->load(std::memory_order_relaxed);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> flag_ = std::make_shared<std::atomic<bool>>(false);
+};
+
+// Runs func(0) ... func(count - 1) on the pool, func(0) on the calling
+// thread, and returns once all of them are done.
+template<typename Func>
+void for_each_index(thread_pool& pool, std::size_t count, Func func)
+{
+    task_group tasks(pool);
+    for (std::size_t i = 1; i < count; ++i)
+        tasks.run([func, i]() { func(i); });
+    if (count > 0)
+        func(0);
+    tasks.wait();
+}
+
+// Process wide pool used by the parallel sorts when the caller brings none.
+inline thread_pool& default_pool()
+{
+    static thread_pool pool;
+    return pool;
+}
+
+} // namespace parallel
+
+// Opt-in instrumentation: sorting with instrument::counting(collector, cmp)
+// in place of cmp makes the engines report into the collector. Other
+// comparators never reach this code, so uninstrumented sorts pay nothing.
+// Instrumented sorts are slower, every event is an atomic increment, and
+// always take the scalar partition paths.
+namespace instrument
+{
+
+constexpr std::size_t balance_buckets = 8;
+constexpr std::size_t timed_levels = 64;
+
+// Snapshot of a collector. balance[i] counts partition steps whose smaller
+// side held between i/16 and (i+1)/16 of the partitioned elements.
+// nanoseconds[d] is the time spent in partition steps at depth d, summed
+// over threads; deeper steps are added to the last entry.
+struct stats
+{
+    std::uint64_t comparisons = 0;
+    std::uint64_t swaps = 0;
+    std::uint64_t moves = 0;
+    std::uint64_t partitions = 0;
+    std::uint64_t max_depth = 0;
+    std::array<std::uint64_t, balance_buckets> balance{};
+    std::array<std::uint64_t, timed_levels> nanoseconds{};
+};
+
+// Shared by all copies of a counting comparator, including those on other
+// threads.
+class collector
+{
+public:
+    void comparison()
+    {
+        comparisons_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void swaps(std::size_t n)
+    {
+        swaps_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void moves(std::size_t n)
+    {
+        moves_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void partition(std::size_t depth, std::ptrdiff_t left, std::ptrdiff_t right, std::chrono::nanoseconds elapsed)
+    {
+        partitions_.fetch_add(1, std::memory_order_relaxed);
+        nanoseconds_[std::min(depth, timed_levels - 1)].fetch_add(static_cast<std::uint64_t>(elapsed.count()), std::memory_order_relaxed);
+
+        auto max = max_depth_.load(std::memory_order_relaxed);
+        while (depth > max && !max_depth_.compare_exchange_weak(max, depth, std::memory_order_relaxed))
+        {
+        }
+
+        if (left + right > 0)
+        {
+            const auto bucket = static_cast<std::size_t>(2 * balance_buckets * std::min(left, right) / (left + right));
+            balance_[std::min(bucket, balance_buckets - 1)].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    stats snapshot() const
+    {
+        stats result;
+        result.comparisons = comparisons_.load(std::memory_order_relaxed);
+        result.swaps = swaps_.load(std::memory_order_relaxed);
+        result.moves = moves_.load(std::memory_order_relaxed);
+        result.partitions = partitions_.load(std::memory_order_relaxed);
+        result.max_depth = max_depth_.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < balance_buckets; ++i)
+            result.balance[i] = balance_[i].load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < timed_levels; ++i)
+            result.nanoseconds[i] = nanoseconds_[i].load(std::memory_order_relaxed);
+        return result;
+    }
+
+private:
+    std::atomic<std::uint64_t> comparisons_{0};
+    std::atomic<std::uint64_t> swaps_{0};
+    std::atomic<std::uint64_t> moves_{0};
+    std::atomic<std::uint64_t> partitions_{0};
+    std::atomic<std::uint64_t> max_depth_{0};
+    std::array<std::atomic<std::uint64_t>, balance_buckets> balance_{};
+    std::array<std::atomic<std::uint64_t>, timed_levels> nanoseconds_{};
+};
+
+// Comparator wrapper counting every comparison into a collector.
+template<typename Cmp = std::less<>>
+class counting
+{
+public:
+    explicit counting(collector& sink, Cmp cmp = Cmp{})
+        : cmp_(cmp), sink_(&sink)
+    {
+    }
+
+    template<typename T, typename U>
+    bool operator()(const T& a, const U& b) const
+    {
+        sink_->comparison();
+        return cmp_(a, b);
+    }
+
+    collector& sink() const
+    {
+        return *sink_;
+    }
+
+private:
+    Cmp cmp_;
+    collector* sink_;
+};
+
+// Overloads of the detail::note_* hooks, found through ADL.
+template<typename Cmp>
+void note_moves(const counting<Cmp>& cmp, std::size_t n)
+{
+    cmp.sink().moves(n);
+}
+
+template<typename Cmp>
+void note_swaps(const counting<Cmp>& cmp, std::size_t n)
+{
+    cmp.sink().swaps(n);
+}
+
+template<typename Cmp>
+std::chrono::steady_clock::time_point start_step(const counting<Cmp>&)
+{
+    return std::chrono::steady_clock::now();
+}
+
+template<typename Cmp>
+void note_partition(const counting<Cmp>& cmp, std::size_t depth, std::ptrdiff_t left, std::ptrdiff_t right, std::chrono::steady_clock::time_point started)
+{
+    cmp.sink().partition(depth, left, right, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started));
+}
+
+} // namespace instrument
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(QUICKSORT_NO_SIMD)
+#define QUICKSORT_X86_SIMD 1
+#include <immintrin.h>
+#define QUICKSORT_TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#define QUICKSORT_TARGET_AVX512 __attribute__((target("avx512f,popcnt")))
+#endif
+
+namespace detail
+{
+
+template<typename It, typename = void>
+struct is_contiguous_iterator : std::is_pointer<It> {};
+
+#if defined(__cpp_lib_concepts)
+template<typename It>
+struct is_contiguous_iterator<It, std::enable_if_t<std::contiguous_iterator<It>>> : std::true_type {};
+#else
+template<typename It>
+struct is_contiguous_iterator<It, std::enable_if_t<
+    std::is_same<It, typename std::vector<typename std::iterator_traits<It>::value_type>::iterator>::value>>
+    : std::true_type {};
+#endif
+
+// Vectorized "less than pivot" partitioning of plain arithmetic keys. Every
+// kernel partitions [first, last) around a pivot value and returns the first
+// element that is not less than it. The kernel is picked once at runtime from
+// what the CPU supports, so a single binary runs on every x86-64 machine.
+namespace simd
+{
+
+enum class isa { scalar, avx2, avx512 };
+
+template<typename T>
+constexpr bool is_key_type = (std::is_integral<T>::value && !std::is_same<T, bool>::value && (sizeof(T) == 4 || sizeof(T) == 8))
+    || std::is_same<T, float>::value || std::is_same<T, double>::value;
+
+template<typename It, typename Cmp>
+constexpr bool is_supported = is_contiguous_iterator<It>::value
+    && is_key_type<typename std::iterator_traits<It>::value_type>
+    && (std::is_same<Cmp, std::less<>>::value || std::is_same<Cmp, std::less<typename std::iterator_traits<It>::value_type>>::value);
+
+template<typename T>
+T* scalar_partition(T* first, T* last, T pivot)
+{
+    return std::partition(first, last, [pivot](T val) { return val < pivot; });
+}
+
+#if defined(QUICKSORT_X86_SIMD)
+
+inline isa detect_isa()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return isa::avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return isa::avx2;
+    return isa::scalar;
+}
+
+template<typename T, typename = void>
+struct avx512_ops;
+
+template<typename T>
+struct avx512_ops<T, std::enable_if_t<std::is_integral<T>::value && sizeof(T) == 4>>
+{
+    using reg = __m512i;
+    static constexpr int lanes = 16;
+
+    QUICKSORT_TARGET_AVX512 static reg load(const T* p) { return _mm512_loadu_si512(p); }
+    QUICKSORT_TARGET_AVX512 static reg set1(T v) { return _mm512_set1_epi32(static_cast<int>(v)); }
+    QUICKSORT_TARGET_AVX512 static unsigned less(reg a, reg b)
+    {
+        return std::is_signed<T>::value ? _mm512_cmplt_epi32_mask(a, b) : _mm512_cmplt_epu32_mask(a, b);
+    }
+    QUICKSORT_TARGET_AVX512 static void compress_store(T* p, unsigned mask, reg v)
+    {
+        _mm512_mask_compressstoreu_epi32(p, static_cast<__mmask16>(mask), v);
+    }
+};
+
+template<typename T>
+struct avx512_ops<T, std::enable_if_t<std::is_integral<T>::value && sizeof(T) == 8>>
+{
+    using reg = __m512i;
+    static constexpr int lanes = 8;
+
+    QUICKSORT_TARGET_AVX512 static reg load(const T* p) { return _mm512_loadu_si512(p); }
+    QUICKSORT_TARGET_AVX512 static reg set1(T v) { return _mm512_set1_epi64(static_cast<long long>(v)); }
+    QUICKSORT_TARGET_AVX512 static unsigned less(reg a, reg b)
+    {
+        return std::is_signed<T>::value ? _mm512_cmplt_epi64_mask(a, b) : _mm512_cmplt_epu64_mask(a, b);
+    }
+    QUICKSORT_TARGET_AVX512 static void compress_store(T* p, unsigned mask, reg v)
+    {
+        _mm512_mask_compressstoreu_epi64(p, static_cast<__mmask8>(mask), v);
+    }
+};
+
+template<>
+struct avx512_ops<float>
+{
+    using reg = __m512;
+    static constexpr int lanes = 16;
+
+    QUICKSORT_TARGET_AVX512 static reg load(const float* p) { return _mm512_loadu_ps(p); }
+    QUICKSORT_TARGET_AVX512 static reg set1(float v) { return _mm512_set1_ps(v); }
+    QUICKSORT_TARGET_AVX512 static unsigned less(reg a, reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    QUICKSORT_TARGET_AVX512 static void compress_store(float* p, unsigned mask, reg v)
+    {
+        _mm512_mask_compressstoreu_ps(p, static_cast<__mmask16>(mask), v);
+    }
+};
+
+template<>
+struct avx512_ops<double>
+{
+    using reg = __m512d;
+    static constexpr int lanes = 8;
+
+    QUICKSORT_TARGET_AVX512 static reg load(const double* p) { return _mm512_loadu_pd(p); }
+    QUICKSORT_TARGET_AVX512 static reg set1(double v) { return _mm512_set1_pd(v); }
+    QUICKSORT_TARGET_AVX512 static unsigned less(reg a, reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    QUICKSORT_TARGET_AVX512 static void compress_store(double* p, unsigned mask, reg v)
+    {
+        _mm512_mask_compressstoreu_pd(p, static_cast<__mmask8>(mask), v);
+    }
+};
+
+// AVX2 has no compress store. The lanes are instead permuted so that the
+// ones below the pivot come first, and the whole vector is written to both
+// ends; each side only keeps its share.
+template<int Lanes>
+struct permutation_table
+{
+    static constexpr int words_per_lane = 8 / Lanes;
+
+    static constexpr std::array<std::array<std::uint32_t, 8>, (1 << Lanes)> make()
+    {
+        std::array<std::array<std::uint32_t, 8>, (1 << Lanes)> table{};
+        for (int mask = 0; mask < (1 << Lanes); ++mask)
+        {
+            int out = 0;
+            for (int pass = 0; pass < 2; ++pass)
+                for (int lane = 0; lane < Lanes; ++lane)
+                    if (((mask >> lane) & 1) == (pass == 0 ? 1 : 0))
+                    {
+                        for (int w = 0; w < words_per_lane; ++w)
+                            table[mask][out * words_per_lane + w] = static_cast<std::uint32_t>(lane * words_per_lane + w);
+                        ++out;
+                    }
+        }
+        return table;
+    }
+
+    static constexpr auto table = make();
+};
+
+template<typename T, typename = void>
+struct avx2_ops;
+
+template<typename T>
+struct avx2_ops<T, std::enable_if_t<std::is_integral<T>::value && sizeof(T) == 4>>
+{
+    using reg = __m256i;
+    static constexpr int lanes = 8;
+
+    QUICKSORT_TARGET_AVX2 static reg load(const T* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    QUICKSORT_TARGET_AVX2 static void store(T* p, reg v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    QUICKSORT_TARGET_AVX2 static reg set1(T v) { return _mm256_set1_epi32(static_cast<int>(v)); }
+    QUICKSORT_TARGET_AVX2 static unsigned less(reg a, reg b)
+    {
+        if (!std::is_signed<T>::value)
+        {
+            const auto bias = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+            a = _mm256_xor_si256(a, bias);
+            b = _mm256_xor_si256(b, bias);
+        }
+        return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(b, a))));
+    }
+    QUICKSORT_TARGET_AVX2 static reg permute(reg v, __m256i index) { return _mm256_permutevar8x32_epi32(v, index); }
+};
+
+template<typename T>
+struct avx2_ops<T, std::enable_if_t<std::is_integral<T>::value && sizeof(T) == 8>>
+{
+    using reg = __m256i;
+    static constexpr int lanes = 4;
+
+    QUICKSORT_TARGET_AVX2 static reg load(const T* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    QUICKSORT_TARGET_AVX2 static void store(T* p, reg v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    QUICKSORT_TARGET_AVX2 static reg set1(T v) { return _mm256_set1_epi64x(static_cast<long long>(v)); }
+    QUICKSORT_TARGET_AVX2 static unsigned less(reg a, reg b)
+    {
+        if (!std::is_signed<T>::value)
+        {
+            const auto bias = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+            a = _mm256_xor_si256(a, bias);
+            b = _mm256_xor_si256(b, bias);
+        }
+        return static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(b, a))));
+    }
+    QUICKSORT_TARGET_AVX2 static reg permute(reg v, __m256i index) { return _mm256_permutevar8x32_epi32(v, index); }
+};
+
+template<>
+struct avx2_ops<float>
+{
+    using reg = __m256;
+    static constexpr int lanes = 8;
+
+    QUICKSORT_TARGET_AVX2 static reg load(const float* p) { return _mm256_loadu_ps(p); }
+    QUICKSORT_TARGET_AVX2 static void store(float* p, reg v) { _mm256_storeu_ps(p, v); }
+    QUICKSORT_TARGET_AVX2 static reg set1(float v) { return _mm256_set1_ps(v); }
+    QUICKSORT_TARGET_AVX2 static unsigned less(reg a, reg b)
+    {
+        return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ)));
+    }
+    QUICKSORT_TARGET_AVX2 static reg permute(reg v, __m256i index) { return _mm256_permutevar8x32_ps(v, index); }
+};
+
+template<>
+struct avx2_ops<double>
+{
+    using reg = __m256d;
+    static constexpr int lanes = 4;
+
+    QUICKSORT_TARGET_AVX2 static reg load(const double* p) { return _mm256_loadu_pd(p); }
+    QUICKSORT_TARGET_AVX2 static void store(double* p, reg v) { _mm256_storeu_pd(p, v); }
+    QUICKSORT_TARGET_AVX2 static reg set1(double v) { return _mm256_set1_pd(v); }
+    QUICKSORT_TARGET_AVX2 static unsigned less(reg a, reg b)
+    {
+        return static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ)));
+    }
+    QUICKSORT_TARGET_AVX2 static reg permute(reg v, __m256i index)
+    {
+        return _mm256_castps_pd(_mm256_permutevar8x32_ps(_mm256_castpd_ps(v), index));
+    }
+};
+
+// Both kernels keep one vector from each end in registers, which leaves 2W
+// free slots in memory. Loading the next vector from the side with less free
+// room guarantees that either side can take a full vector before it is
+// stored, so the partition runs in place without a scratch buffer.
+
+// Writes the lanes of v below the pivot at left and the others just below
+// right, moving both cursors.
+template<typename ops, typename T>
+QUICKSORT_TARGET_AVX512 __attribute__((always_inline)) inline
+void avx512_store(typename ops::reg v, typename ops::reg pivot_vec, T*& left, T*& right)
+{
+    const auto mask = ops::less(v, pivot_vec);
+    const auto count = __builtin_popcount(mask);
+    ops::compress_store(left, mask, v);
+    left += count;
+    right -= ops::lanes - count;
+    ops::compress_store(right, ~mask & ((1u << ops::lanes) - 1), v);
+}
+
+template<typename ops, typename T>
+QUICKSORT_TARGET_AVX2 __attribute__((always_inline)) inline
+void avx2_store(typename ops::reg v, typename ops::reg pivot_vec, T*& left, T*& right)
+{
+    using table = permutation_table<ops::lanes>;
+
+    const auto mask = ops::less(v, pivot_vec);
+    const auto count = __builtin_popcount(mask);
+    const auto index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(table::table[mask].data()));
+    const auto permuted = ops::permute(v, index);
+    ops::store(left, permuted);
+    ops::store(right - ops::lanes, permuted);
+    left += count;
+    right -= ops::lanes - count;
+}
+
+template<typename T>
+QUICKSORT_TARGET_AVX512 T* avx512_partition(T* first, T* last, T pivot)
+{
+    using ops = avx512_ops<T>;
+    constexpr int lanes = ops::lanes;
+
+    const auto pivot_vec = ops::set1(pivot);
+    T* left = first;
+    T* right = last;
+
+    const auto first_vec = ops::load(first);
+    const auto last_vec = ops::load(last - lanes);
+    T* read_left = first + lanes;
+    T* read_right = last - lanes;
+
+    while (read_right - read_left >= lanes)
+    {
+        typename ops::reg v;
+        if (read_left - left <= right - read_right)
+        {
+            v = ops::load(read_left);
+            read_left += lanes;
+        }
+        else
+        {
+            read_right -= lanes;
+            v = ops::load(read_right);
+        }
+        avx512_store<ops>(v, pivot_vec, left, right);
+    }
+
+    T rest[lanes];
+    const auto rest_size = read_right - read_left;
+    std::copy(read_left, read_right, rest);
+
+    // [left, right) is now one contiguous hole of 2W + rest_size slots.
+    // The remainder goes first so the two vectors always fit.
+    for (std::ptrdiff_t i = 0; i < rest_size; ++i)
+    {
+        if (rest[i] < pivot)
+            *left++ = rest[i];
+        else
+            *--right = rest[i];
+    }
+    avx512_store<ops>(first_vec, pivot_vec, left, right);
+    avx512_store<ops>(last_vec, pivot_vec, left, right);
+
+    return left;
+}
+
+template<typename T>
+QUICKSORT_TARGET_AVX2 T* avx2_partition(T* first, T* last, T pivot)
+{
+    using ops = avx2_ops<T>;
+    constexpr int lanes = ops::lanes;
+
+    const auto pivot_vec = ops::set1(pivot);
+    T* left = first;
+    T* right = last;
+
+    const auto first_vec = ops::load(first);
+    const auto last_vec = ops::load(last - lanes);
+    T* read_left = first + lanes;
+    T* read_right = last - lanes;
+
+    while (read_right - read_left >= lanes)
+    {
+        typename ops::reg v;
+        if (read_left - left <= right - read_right)
+        {
+            v = ops::load(read_left);
+            read_left += lanes;
+        }
+        else
+        {
+            read_right -= lanes;
+            v = ops::load(read_right);
+        }
+        avx2_store<ops>(v, pivot_vec, left, right);
+    }
+
+    T rest[lanes];
+    const auto rest_size = read_right - read_left;
+    std::copy(read_left, read_right, rest);
+
+    // the last vector may be stored over the same W slots from both ends,
+    // which is fine as both stores write identical data
+    for (std::ptrdiff_t i = 0; i < rest_size; ++i)
+    {
+        if (rest[i] < pivot)
+            *left++ = rest[i];
+        else
+            *--right = rest[i];
+    }
+    avx2_store<ops>(first_vec, pivot_vec, left, right);
+    avx2_store<ops>(last_vec, pivot_vec, left, right);
+
+    return left;
+}
+
+inline isa detected_isa()
+{
+    static const isa value = detect_isa();
+    return value;
+}
+
+#else
+
+inline isa detected_isa()
+{
+    return isa::scalar;
+}
+
+#endif
+
+// Ranges shorter than this are not worth the setup of the vector kernels.
+constexpr std::ptrdiff_t min_size = 64;
+
+// Returns the split point and whether the range was already partitioned,
+// in which case nothing was moved. Elements already on their side at either
+// end are skipped before the kernel runs; on random input that costs a
+// comparison or two, on partitioned input it replaces the kernel.
+template<typename T>
+std::pair<T*, bool> partition(T* first, T* last, T pivot, isa level = detected_isa())
+{
+    while (first < last && *first < pivot)
+        ++first;
+    while (first < last && !(*(last - 1) < pivot))
+        --last;
+    if (first == last)
+        return {first, true};
+
+#if defined(QUICKSORT_X86_SIMD)
+    if (last - first >= min_size)
+    {
+        if (level == isa::avx512)
+            return {avx512_partition(first, last, pivot), false};
+        if (level == isa::avx2)
+            return {avx2_partition(first, last, pivot), false};
+    }
+#endif
+    (void) level;
+    return {scalar_partition(first, last, pivot), false};
+}
+
+} // namespace simd
+
+// Hoare partition of [first, last) into elements less than pivot followed
+// by the rest, returning the boundary. One misplaced element is lifted out
+// to open a hole that the scan alternately fills from each end, so every
+// misplaced element costs one move instead of the three of a swap. pivot
+// must not live inside the range. The flag tells whether the range was
+// partitioned already, i.e. nothing had to be moved.
+template<typename BiIt, typename T, typename Cmp>
+std::pair<BiIt, bool> hole_partition(BiIt first, BiIt last, const T& pivot, Cmp& cmp)
+{
+    while (first != last && cmp(*first, pivot))
+        ++first;
+    while (first != last && !cmp(*std::prev(last), pivot))
+        --last;
+    if (first == last)
+        return {first, true};
+
+    // *first belongs right and *--last belongs left
+    typename std::iterator_traits<BiIt>::value_type value = std::move(*first);
+    std::size_t moves = 2;
+    --last;
+    for (;;)
+    {
+        *first = std::move(*last);
+        ++moves;
+        do
+            ++first;
+        while (first != last && cmp(*first, pivot));
+        if (first == last)
+            break;
+
+        *last = std::move(*first);
+        ++moves;
+        do
+            --last;
+        while (first != last && !cmp(*last, pivot));
+        if (first == last)
+            break;
+    }
+
+    *first = std::move(value);
+    note_moves(cmp, moves);
+    return {first, false};
+}
+
+// For a pivot at first that nothing in the range is less than: moves the
+// keys equal to it right behind it and returns the end of that block. Lets
+// the less-than schemes skip all copies of the minimum at once, so inputs
+// with few distinct keys do not go quadratic.
+template<typename Cmp>
+struct not_greater
+{
+    Cmp& cmp;
+
+    template<typename T, typename U>
+    bool operator()(const T& a, const U& b) const
+    {
+        return !cmp(b, a);
+    }
+};
+
+// Forwards the moves of the gather to the hooks of the wrapped comparator.
+template<typename Cmp>
+void note_moves(const not_greater<Cmp>& wrapped, std::size_t n)
+{
+    note_moves(wrapped.cmp, n);
+}
+
+template<typename BiIt, typename Cmp>
+std::pair<BiIt, bool> gather_minimum(BiIt first, BiIt last, Cmp& cmp)
+{
+    not_greater<Cmp> wrapped{cmp};
+    return hole_partition(std::next(first), last, *first, wrapped);
+}
+
+} // namespace detail
+
+namespace partition
+{
+
+// unqualified in the schemes, so instrumented comparators are found by ADL
+using detail::note_moves;
+using detail::note_swaps;
+
+// Block of elements equivalent to the pivot after a partition step. Callers
+// only recurse into [first, lower) and [upper, last).
+template<typename BiIt>
+struct result
+{
+    BiIt lower;
+    BiIt upper;
+    // set by schemes that found the range already split and moved nothing;
+    // the sides are then likely sorted as well
+    bool already_partitioned = false;
+};
+
+// Classic scheme: everything less than the pivot to the left, the rest to
+// the right. The pivot is expected at first and ends up at lower.
+struct two_way
+{
+    template<typename BiIt, typename Cmp>
+    result<BiIt> operator()(BiIt first, BiIt last, Cmp cmp) const
+    {
+        if constexpr (detail::simd::is_supported<BiIt, Cmp>)
+        {
+            // contiguous arithmetic keys under operator<: vector kernel
+            auto data = std::addressof(*first);
+            auto split = detail::simd::partition(data + 1, data + (last - first), *data);
+            auto pivot = first + (split.first - data - 1);
+            if (pivot == first)
+            {
+                auto equal = detail::gather_minimum(first, last, cmp);
+                return {first, equal.first, equal.second};
+            }
+            std::iter_swap(pivot, first);
+            return {pivot, std::next(pivot), split.second};
+        }
+
+        // compared in place: the scan never touches first
+        auto split = detail::hole_partition(std::next(first), last, *first, cmp);
+
+        auto pivot = std::prev(split.first);
+        if (pivot == first)
+        {
+            auto equal = detail::gather_minimum(first, last, cmp);
+            return {first, equal.first, equal.second};
+        }
+        std::iter_swap(pivot, first);
+        note_swaps(cmp, 1);
+        return {pivot, split.first, split.second};
+    }
+};
+
+// Dijkstra's dutch national flag: less | equal | greater in a single pass.
+// Keys equal to the pivot are final after the step and never revisited,
+// which keeps low cardinality inputs at O(n log k) for k distinct keys.
+struct three_way
+{
+    template<typename BiIt, typename Cmp>
+    result<BiIt> operator()(BiIt first, BiIt last, Cmp cmp) const
+    {
+        // [first, lt) < pivot, [lt, it) == pivot, [gt, last) > pivot.
+        // lt always points into the equal block, so it stands in for the pivot.
+        auto lt = first;
+        auto it = std::next(first);
+        auto gt = last;
+
+        while (it != gt)
+        {
+            if (cmp(*it, *lt))
+            {
+                std::iter_swap(lt, it);
+                note_swaps(cmp, 1);
+                ++lt;
+                ++it;
+            }
+            else if (cmp(*lt, *it))
+            {
+                std::iter_swap(it, --gt);
+                note_swaps(cmp, 1);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        return {lt, gt};
+    }
+};
+
+// Branchless block partitioning after Edelkamp and Weiss (BlockQuicksort).
+// Comparison results of a block from each end are first written into offset
+// buffers without branching on them; misplaced pairs are swapped afterwards.
+// Requires random access iterators.
+struct block
+{
+    static constexpr std::ptrdiff_t block_size = 64;
+
+    template<typename RandomIt, typename Cmp>
+    result<RandomIt> operator()(RandomIt first, RandomIt last, Cmp cmp) const
+    {
+        const auto& pivot = *first;
+        auto l = std::next(first);
+        auto r = last;
+
+        // offsets of elements >= pivot in the left block and < pivot in the
+        // right block, counted from the outer end of each block
+        alignas(64) unsigned char offsets_l[block_size];
+        alignas(64) unsigned char offsets_r[block_size];
+        std::ptrdiff_t num_l = 0, num_r = 0, start_l = 0, start_r = 0;
+        bool moved = false;
+
+        while (r - l > 2 * block_size)
+        {
+            if (num_l == 0)
+            {
+                start_l = 0;
+                for (std::ptrdiff_t i = 0; i < block_size; ++i)
+                {
+                    offsets_l[num_l] = static_cast<unsigned char>(i);
+                    num_l += !cmp(l[i], pivot);
+                }
+            }
+
+            if (num_r == 0)
+            {
+                start_r = 0;
+                for (std::ptrdiff_t i = 0; i < block_size; ++i)
+                {
+                    offsets_r[num_r] = static_cast<unsigned char>(i);
+                    num_r += cmp(*(r - 1 - i), pivot);
+                }
+            }
+
+            // one cyclic permutation instead of num swaps: 2 * num + 1 moves
+            const auto num = std::min(num_l, num_r);
+            if (num > 0)
+            {
+                moved = true;
+                auto left = [&](std::ptrdiff_t k) { return l + offsets_l[start_l + k]; };
+                auto right = [&](std::ptrdiff_t k) { return r - 1 - offsets_r[start_r + k]; };
+
+                typename std::iterator_traits<RandomIt>::value_type value = std::move(*left(0));
+                *left(0) = std::move(*right(0));
+                for (std::ptrdiff_t k = 1; k < num; ++k)
+                {
+                    *right(k - 1) = std::move(*left(k));
+                    *left(k) = std::move(*right(k));
+                }
+                *right(num - 1) = std::move(value);
+                note_moves(cmp, static_cast<std::size_t>(2 * num + 1));
+            }
+
+            num_l -= num;
+            num_r -= num;
+            start_l += num;
+            start_r += num;
+
+            if (num_l == 0)
+                l += block_size;
+            if (num_r == 0)
+                r -= block_size;
+        }
+
+        // [first+1, l) < pivot and [r, last) >= pivot, the rest is small
+        auto split = detail::hole_partition(l, r, pivot, cmp);
+
+        auto pivot_position = std::prev(split.first);
+        if (pivot_position == first)
+        {
+            auto equal = detail::gather_minimum(first, last, cmp);
+            return {first, equal.first, !moved && equal.second};
+        }
+        std::iter_swap(pivot_position, first);
+        note_swaps(cmp, 1);
+        return {pivot_position, split.first, !moved && split.second};
+    }
+};
+
+} // namespace partition
+
+namespace detail
+{
+
+// A callable applied to single elements, e.g. a member accessor. Used to
+// tell projections apart from pivot policies, which take two iterators.
+template<typename F, typename It>
+constexpr bool is_projection = std::is_invocable<F&, typename std::iterator_traits<It>::reference>::value
+    && !std::is_invocable<F&, It, It>::value;
+
+// Compares elements by their projections.
+template<typename Cmp, typename Proj>
+struct projected_compare
+{
+    Cmp cmp;
+    Proj proj;
+
+    template<typename T, typename U>
+    bool operator()(const T& a, const U& b) const
+    {
+        return cmp(std::invoke(proj, a), std::invoke(proj, b));
+    }
+};
+
+// Pivot policies that compare elements take the sort's comparator.
+template<typename Pivot_func, typename BiIt, typename Cmp>
+BiIt choose_pivot(Pivot_func& pivot_func, BiIt first, BiIt last, Cmp& cmp)
+{
+    static_assert(std::is_invocable_r<BiIt, Pivot_func&, BiIt, BiIt, Cmp&>::value || std::is_invocable_r<BiIt, Pivot_func&, BiIt, BiIt>::value,
+                  "Pivot_func must be callable as pivot_func(first, last) or pivot_func(first, last, cmp) and return an iterator");
+
+    if constexpr (std::is_invocable<Pivot_func&, BiIt, BiIt, Cmp&>::value)
+        return pivot_func(first, last, cmp);
+    else
+        return pivot_func(first, last);
+}
+
+// Moves the chosen pivot to the front and lets the partition scheme split
+// the range around it.
+template<typename BiIt, typename Pivot_func, typename Cmp, typename Partition_func>
+partition::result<BiIt> partition_around_pivot(BiIt first, BiIt last, Pivot_func pivot_func, Cmp cmp, Partition_func partition_func)
+{
+    static_assert(std::is_invocable_r<bool, Cmp&, typename std::iterator_traits<BiIt>::reference, typename std::iterator_traits<BiIt>::reference>::value,
+                  "Cmp must be callable as cmp(a, b) on two elements and return something convertible to bool");
+
+    std::iter_swap(first, choose_pivot(pivot_func, first, last, cmp));
+    note_swaps(cmp, 1);
+    return partition_func(first, last, cmp);
+}
+
+// Leading runs merged by the presortedness pre-pass, at most.
+constexpr std::size_t max_presorted_runs = 8;
+
+// Pre-pass for inputs that are sorted, reversed or a few concatenated runs,
+// e.g. appends to an ordered log. Scans for maximal non-descending and
+// strictly descending runs, at most max_presorted_runs of them; random
+// inputs are rejected after a few dozen comparisons. If the runs cover at
+// least half of the range, descending ones are reversed and the runs merged
+// naturally, always the adjacent pair with the fewest elements first, which
+// keeps the merge cost close to n log(runs). Returns the end of the sorted
+// prefix established this way, first if the pre-pass did nothing.
+template<typename BiIt, typename Cmp>
+BiIt presorted_prefix(BiIt first, BiIt last, Cmp& cmp)
+{
+    const auto total = std::distance(first, last);
+    if (total <= small_instance_threshold)
+        return first;
+
+    std::array<BiIt, max_presorted_runs + 1> bounds;
+    std::array<std::ptrdiff_t, max_presorted_runs> sizes;
+    std::array<bool, max_presorted_runs> descending;
+    std::size_t runs = 0;
+    std::ptrdiff_t scanned = 0;
+
+    bounds[0] = first;
+    for (auto it = first; it != last && runs < max_presorted_runs; ++runs)
+    {
+        auto next = std::next(it);
+        std::ptrdiff_t size = 1;
+        descending[runs] = next != last && cmp(*next, *it);
+        while (next != last && cmp(*next, *it) == descending[runs])
+        {
+            it = next++;
+            ++size;
+        }
+        it = next;
+        bounds[runs + 1] = it;
+        sizes[runs] = size;
+        scanned += size;
+    }
+
+    if (2 * scanned < total)
+        return first;
+
+    for (std::size_t i = 0; i < runs; ++i)
+        if (descending[i])
+        {
+            std::reverse(bounds[i], bounds[i + 1]);
+            note_swaps(cmp, sizes[i] / 2);
+        }
+
+    for (; runs > 1; --runs)
+    {
+        std::size_t i = 0;
+        for (std::size_t j = 1; j + 1 < runs; ++j)
+            if (sizes[j] + sizes[j + 1] < sizes[i] + sizes[i + 1])
+                i = j;
+
+        // a reversed run can continue its neighbour without any merging
+        if (cmp(*bounds[i + 1], *std::prev(bounds[i + 1])))
+            std::inplace_merge(bounds[i], bounds[i + 1], bounds[i + 2], cmp);
+
+        sizes[i] += sizes[i + 1];
+        std::move(bounds.begin() + i + 2, bounds.begin() + runs + 1, bounds.begin() + i + 1);
+        std::move(sizes.begin() + i + 2, sizes.begin() + runs, sizes.begin() + i + 1);
+    }
+    return bounds[1];
+}
+
+// Sorts what the pre-pass left over with sort and merges it into the
+// sorted prefix.
+template<typename BiIt, typename Cmp, typename Sort>
+void sort_presorted(BiIt first, BiIt last, Cmp& cmp, Sort sort)
+{
+    const auto middle = presorted_prefix(first, last, cmp);
+    if (middle == last)
+        return;
+
+    sort(middle, last);
+    if (middle != first)
+        std::inplace_merge(first, middle, last, cmp);
+}
+
+template<typename RandomIt, typename Cmp>
+void heap_sort(RandomIt first, RandomIt last, Cmp cmp)
+{
+    std::make_heap(first, last, cmp);
+    std::sort_heap(first, last, cmp);
+}
+
+template<typename Size>
+int log2(Size n)
+{
+    int result = 0;
+    while (n > 1)
+    {
+        n >>= 1;
+        ++result;
+    }
+    return result;
+}
+
+// After a partition step that moved nothing the input was probably sorted
+// to begin with; a bounded insertion sort of both sides then finishes the
+// range in linear time, or gives up quickly if it was not.
+template<typename BiIt, typename Cmp>
+bool split_sorted(BiIt first, BiIt last, const partition::result<BiIt>& split, Cmp& cmp)
+{
+    return split.already_partitioned
+        && partial_insertion_sort(first, split.lower, cmp)
+        && partial_insertion_sort(split.upper, last, cmp);
+}
+
+// depth counts the partition steps above [first, last).
+template<typename BiIt, typename Pivot_func, typename Cmp, typename Partition_func>
+void quicksort_loop(BiIt first, BiIt last, Pivot_func pivot_func, Cmp cmp, Partition_func partition_func, std::size_t depth)
+{
+    for (; !sort_small_instances(first, last, cmp); ++depth)
+    {
+        const auto started = start_step(cmp);
+        auto split = partition_around_pivot(first, last, pivot_func, cmp, partition_func);
+        const auto left = std::distance(first, split.lower);
+        const auto right = std::distance(split.upper, last);
+        note_partition(cmp, depth, left, right, started);
+        if (split_sorted(first, last, split, cmp))
+            return;
+
+        // recurse into the smaller side, keep looping on the larger one
+        if (left < right)
+        {
+            quicksort_loop(first, split.lower, pivot_func, cmp, partition_func, depth + 1);
+            first = split.upper;
+        }
+        else
+        {
+            quicksort_loop(split.upper, last, pivot_func, cmp, partition_func, depth + 1);
+            last = split.lower;
+        }
+    }
+}
+
+// Engine for ranges without random access, e.g. std::list or
+// std::forward_list: the length of every subrange is carried through the
+// recursion, so it is never recomputed by walking, and each partition step
+// is one forward pass plus one walk to the pivot.
+constexpr std::ptrdiff_t forward_insertion_threshold = 16;
+
+// Insertion sort that only steps forward where it has to: bidirectional
+// ranges take insertion_sort, forward ones look for the insertion point
+// from the front and carry the displaced elements up to the hole.
+template<typename ForwardIt, typename Cmp>
+void forward_insertion_sort(ForwardIt first, ForwardIt last, Cmp& cmp)
+{
+    if constexpr (std::is_base_of<std::bidirectional_iterator_tag, typename std::iterator_traits<ForwardIt>::iterator_category>::value)
+    {
+        insertion_sort(first, last, cmp);
+    }
+    else
+    {
+        if (first == last)
+            return;
+
+        for (auto prev = first, begin = std::next(first); begin != last; prev = begin++)
+        {
+            if (!cmp(*begin, *prev))
+                continue;
+
+            auto hole = first;
+            while (!cmp(*begin, *hole))
+                ++hole;
+
+            typename std::iterator_traits<ForwardIt>::value_type value = std::move(*begin);
+            std::size_t moves = 2;
+            for (; hole != begin; ++hole, moves += 3)
+                std::swap(value, *hole);
+
+            *begin = std::move(value);
+            note_moves(cmp, moves);
+        }
+    }
+}
+
+// Lomuto step around pivot. Returns the end of the less than part and the
+// start of the rest, with the pivot, and all keys equal to it if nothing
+// was less, in between. left receives the size of the less than part,
+// middle the size of the block in between.
+template<typename ForwardIt, typename Cmp>
+std::pair<ForwardIt, ForwardIt> forward_partition(ForwardIt first, ForwardIt last, ForwardIt pivot, Cmp& cmp, std::ptrdiff_t& left, std::ptrdiff_t& middle)
+{
+    std::iter_swap(first, pivot);
+
+    auto last_less = first;
+    left = 0;
+    for (auto it = std::next(first); it != last; ++it)
+    {
+        if (cmp(*it, *first))
+        {
+            ++last_less;
+            std::iter_swap(it, last_less);
+            ++left;
+        }
+    }
+
+    if (left == 0)
+    {
+        // gather the copies of the minimum, like gather_minimum does
+        auto end = std::next(first);
+        middle = 1;
+        for (auto it = end; it != last; ++it)
+        {
+            if (!cmp(*first, *it))
+            {
+                std::iter_swap(it, end);
+                ++end;
+                ++middle;
+            }
+        }
+        note_swaps(cmp, static_cast<std::size_t>(middle - 1));
+        return {first, end};
+    }
+
+    std::iter_swap(first, last_less);
+    note_swaps(cmp, left + 1);
+    middle = 1;
+    return {last_less, std::next(last_less)};
+}
+
+// pivot_func is only called when it is not pivot::random, whose draw needs
+// the size alone and is taken without the extra walk to count the range.
+template<typename ForwardIt, typename Cmp>
+void forward_quicksort_loop(ForwardIt first, ForwardIt last, std::ptrdiff_t size, ForwardIt (*pivot_func)(ForwardIt, ForwardIt), Cmp& cmp, std::size_t depth)
+{
+    ForwardIt (*const random_pivot)(ForwardIt, ForwardIt) = pivot::random<ForwardIt>;
+    for (; size > forward_insertion_threshold; ++depth)
+    {
+        const auto pivot = pivot_func == random_pivot
+            ? std::next(first, bounded_random(thread_rng(), size))
+            : pivot_func(first, last);
+
+        const auto started = start_step(cmp);
+        std::ptrdiff_t left, middle;
+        auto split = forward_partition(first, last, pivot, cmp, left, middle);
+        const auto right = size - left - middle;
+        note_partition(cmp, depth, left, right, started);
+
+        if (left < right)
+        {
+            forward_quicksort_loop(first, split.first, left, pivot_func, cmp, depth + 1);
+            first = split.second;
+            size = right;
+        }
+        else
+        {
+            forward_quicksort_loop(split.second, last, right, pivot_func, cmp, depth + 1);
+            last = split.first;
+            size = left;
+        }
+    }
+
+    forward_insertion_sort(first, last, cmp);
+}
+
+// What sequential_quicksort does, for engines that finish their subranges
+// sequentially below the given depth. Ranges without random access go to
+// the forward engine, which does its own Lomuto step, so it only takes the
+// default partition, and pivots given as plain functions of (first, last).
+template<typename BiIt, typename Pivot_func, typename Cmp, typename Partition_func>
+void sequential_sort(BiIt first, BiIt last, Pivot_func& pivot_func, Cmp& cmp, Partition_func& partition_func, std::size_t depth)
+{
+    if constexpr (std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<BiIt>::iterator_category>::value)
+    {
+        sort_presorted(first, last, cmp, [&](BiIt begin, BiIt end) {
+            quicksort_loop(begin, end, pivot_func, cmp, partition_func, depth);
+        });
+    }
+    else
+    {
+        static_assert(std::is_same<Pivot_func, BiIt (*)(BiIt, BiIt)>::value,
+                      "ranges without random access only take pivots of type BiIt (*)(BiIt, BiIt), such as pivot::random");
+        static_assert(std::is_same<Partition_func, partition::two_way>::value,
+                      "ranges without random access only take the default partition::two_way");
+        forward_quicksort_loop(first, last, std::distance(first, last), pivot_func, cmp, depth);
+    }
+}
+
+template<typename RandomIt, typename Pivot_func, typename Cmp, typename Partition_func>
+void introsort_loop(RandomIt first, RandomIt last, int depth_limit, Pivot_func pivot_func, Cmp cmp, Partition_func partition_func)
+{
+    while (!sort_small_instances(first, last, cmp))
+    {
+        if (depth_limit-- == 0)
+        {
+            heap_sort(first, last, cmp);
+            return;
+        }
+
+        auto split = partition_around_pivot(first, last, pivot_func, cmp, partition_func);
+        if (split_sorted(first, last, split, cmp))
+            return;
+
+        if (split.lower - first < last - split.upper)
+        {
+            introsort_loop(first, split.lower, depth_limit, pivot_func, cmp, partition_func);
+            first = split.upper;
+        }
+        else
+        {
+            introsort_loop(split.upper, last, depth_limit, pivot_func, cmp, partition_func);
+            last = split.lower;
+        }
+    }
+}
+
+} // namespace detail
+
+template<typename BiIt,
+         typename Pivot_func = decltype(pivot::random<BiIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way,
+         typename = std::enable_if_t<!detail::is_projection<Pivot_func, BiIt>>>
+void sequential_quicksort(BiIt first, BiIt last, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{})
+{
+    detail::sequential_sort(first, last, pivot_func, cmp, partition_func, 0);
+}
+
+// Quicksort with a recursion budget of 2*log2(n); subranges that exhaust it
+// are finished with heapsort, which bounds the worst case to O(n log n).
+template<typename RandomIt,
+         typename Pivot_func = decltype(pivot::random<RandomIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way>
+void introsort_quicksort(RandomIt first, RandomIt last, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{})
+{
+    detail::sort_presorted(first, last, cmp, [&](RandomIt begin, RandomIt end) {
+        detail::introsort_loop(begin, end, 2 * detail::log2(end - begin), pivot_func, cmp, partition_func);
+    });
+}
+
+namespace detail
+{
+
+// Takes one candidate per slice of the range with the single pivot policy,
+// so every pivot::* function serves the multi-pivot engines too, and moves
+// them to the given positions in ascending order.
+template<std::size_t K, typename RandomIt, typename Pivot_func, typename Cmp>
+void choose_pivots(RandomIt first, RandomIt last, const std::array<RandomIt, K>& targets, Pivot_func& pivot_func, Cmp& cmp)
+{
+    const auto size = last - first;
+    for (std::size_t i = 0; i < K; ++i)
+    {
+        const auto slice_first = first + size * static_cast<std::ptrdiff_t>(i) / static_cast<std::ptrdiff_t>(K);
+        const auto slice_last = first + size * static_cast<std::ptrdiff_t>(i + 1) / static_cast<std::ptrdiff_t>(K);
+        std::iter_swap(targets[i], choose_pivot(pivot_func, slice_first, slice_last, cmp));
+    }
+    note_swaps(cmp, K);
+
+    for (std::size_t i = 1; i < K; ++i)
+        for (std::size_t j = i; j > 0; --j)
+            compare_exchange(targets[j - 1], targets[j], cmp);
+}
+
+// Reports a multi-way step to note_partition as the smallest part against
+// the other parts together, the pivots not counted.
+template<typename RandomIt, std::size_t N, typename Cmp, typename Started>
+void note_multiway_partition(Cmp& cmp, std::size_t depth, const std::array<std::pair<RandomIt, RandomIt>, N>& parts, const Started& started)
+{
+    auto smallest = parts[0].second - parts[0].first;
+    auto total = std::ptrdiff_t(0);
+    for (const auto& part : parts)
+    {
+        smallest = std::min(smallest, part.second - part.first);
+        total += part.second - part.first;
+    }
+    note_partition(cmp, depth, smallest, total - smallest, started);
+}
+
+// Sorts the larger part of the last step last, in the loop, so the stack
+// stays logarithmic.
+template<typename RandomIt, std::size_t N, typename Loop>
+void recurse_except_largest(const std::array<std::pair<RandomIt, RandomIt>, N>& parts, RandomIt& first, RandomIt& last, Loop loop)
+{
+    std::size_t largest = 0;
+    for (std::size_t i = 1; i < N; ++i)
+        if (parts[i].second - parts[i].first > parts[largest].second - parts[largest].first)
+            largest = i;
+
+    for (std::size_t i = 0; i < N; ++i)
+        if (i != largest)
+            loop(parts[i].first, parts[i].second);
+
+    first = parts[largest].first;
+    last = parts[largest].second;
+}
+
+// Yaroslavskiy's dual-pivot quicksort: p <= q split the range into
+// < p | p <= x <= q | > q in a single scan. Equal pivots mean a run of equal
+// keys, that step is done by the three way scheme instead.
+template<typename RandomIt, typename Pivot_func, typename Cmp>
+void dual_pivot_loop(RandomIt first, RandomIt last, Pivot_func& pivot_func, Cmp& cmp, std::size_t depth)
+{
+    auto loop = [&](RandomIt begin, RandomIt end) { dual_pivot_loop(begin, end, pivot_func, cmp, depth + 1); };
+
+    for (; !sort_small_instances(first, last, cmp); ++depth)
+    {
+        const auto started = start_step(cmp);
+        choose_pivots<2>(first, last, {first, last - 1}, pivot_func, cmp);
+        const auto p = first;
+        const auto q = last - 1;
+
+        if (!cmp(*p, *q))
+        {
+            const auto split = partition::three_way()(first, last, cmp);
+            const std::array<std::pair<RandomIt, RandomIt>, 2> parts{{{first, split.lower}, {split.upper, last}}};
+            note_multiway_partition(cmp, depth, parts, started);
+            recurse_except_largest(parts, first, last, loop);
+            continue;
+        }
+
+        auto lt = first + 1;
+        auto gt = last - 2;
+        std::size_t swaps = 2;
+        for (auto k = lt; k <= gt; ++k)
+        {
+            if (cmp(*k, *p))
+            {
+                std::iter_swap(k, lt++);
+                ++swaps;
+            }
+            else if (cmp(*q, *k))
+            {
+                while (k < gt && cmp(*q, *gt))
+                    --gt;
+                std::iter_swap(k, gt--);
+                ++swaps;
+                if (cmp(*k, *p))
+                {
+                    std::iter_swap(k, lt++);
+                    ++swaps;
+                }
+            }
+        }
+
+        std::iter_swap(first, --lt);
+        std::iter_swap(last - 1, ++gt);
+        note_swaps(cmp, swaps);
+
+        const std::array<std::pair<RandomIt, RandomIt>, 3> parts{{{first, lt}, {lt + 1, gt}, {gt + 1, last}}};
+        note_multiway_partition(cmp, depth, parts, started);
+        recurse_except_largest(parts, first, last, loop);
+    }
+}
+
+// Kushagra, Lopez-Ortiz, Qiao and Munro's three-pivot quicksort: p <= q <= r
+// split the range into four parts in one scan from both ends with two extra
+// pointers, a < p | p <= b < q | q <= c <= r | r < d. Fewer, larger cache
+// friendly passes than the single pivot schemes.
+template<typename RandomIt, typename Pivot_func, typename Cmp>
+void triple_pivot_loop(RandomIt first, RandomIt last, Pivot_func& pivot_func, Cmp& cmp, std::size_t depth)
+{
+    auto loop = [&](RandomIt begin, RandomIt end) { triple_pivot_loop(begin, end, pivot_func, cmp, depth + 1); };
+
+    for (; !sort_small_instances(first, last, cmp); ++depth)
+    {
+        const auto started = start_step(cmp);
+        choose_pivots<3>(first, last, {first, first + 1, last - 1}, pivot_func, cmp);
+        const auto p = first;
+        const auto q = first + 1;
+        const auto r = last - 1;
+
+        if (!cmp(*p, *r))
+        {
+            const auto split = partition::three_way()(first, last, cmp);
+            const std::array<std::pair<RandomIt, RandomIt>, 2> parts{{{first, split.lower}, {split.upper, last}}};
+            note_multiway_partition(cmp, depth, parts, started);
+            recurse_except_largest(parts, first, last, loop);
+            continue;
+        }
+
+        auto a = first + 2;
+        auto b = first + 2;
+        auto c = last - 2;
+        auto d = last - 2;
+        std::size_t swaps = 4;
+        while (b <= c)
+        {
+            for (; b <= c && cmp(*b, *q); ++b)
+            {
+                if (cmp(*b, *p))
+                {
+                    std::iter_swap(a++, b);
+                    ++swaps;
+                }
+            }
+            for (; b <= c && cmp(*q, *c); --c)
+            {
+                if (cmp(*r, *c))
+                {
+                    std::iter_swap(c, d--);
+                    ++swaps;
+                }
+            }
+            if (b <= c)
+            {
+                const bool b_above_r = cmp(*r, *b);
+                if (cmp(*c, *p))
+                {
+                    std::iter_swap(b, a);
+                    std::iter_swap(a++, c);
+                    swaps += 2;
+                }
+                else
+                {
+                    std::iter_swap(b, c);
+                    ++swaps;
+                }
+                if (b_above_r)
+                {
+                    std::iter_swap(c, d--);
+                    ++swaps;
+                }
+                ++b;
+                --c;
+            }
+        }
+
+        --a;
+        --b;
+        ++d;
+        std::iter_swap(q, a);
+        std::iter_swap(a, b);
+        std::iter_swap(first, --a);
+        std::iter_swap(last - 1, d);
+        note_swaps(cmp, swaps);
+
+        const std::array<std::pair<RandomIt, RandomIt>, 4> parts{{{first, a}, {a + 1, b}, {b + 1, d}, {d + 1, last}}};
+        note_multiway_partition(cmp, depth, parts, started);
+        recurse_except_largest(parts, first, last, loop);
+    }
+}
+
+} // namespace detail
+
+// Dual-pivot quicksort: each step splits the range three ways around two
+// pivots taken by pivot_func from the two halves, and scans it once. Fewer
+// passes over memory than the single pivot engines for large inputs.
+template<typename RandomIt,
+         typename Pivot_func = decltype(pivot::random<RandomIt>),
+         typename Cmp = std::less<>>
+void dual_pivot_quicksort(RandomIt first, RandomIt last, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{})
+{
+    detail::sort_presorted(first, last, cmp, [&](RandomIt begin, RandomIt end) {
+        detail::dual_pivot_loop(begin, end, pivot_func, cmp, 0);
+    });
+}
+
+// Three-pivot quicksort: four way split around pivots taken by pivot_func
+// from the three thirds of the range.
+template<typename RandomIt,
+         typename Pivot_func = decltype(pivot::random<RandomIt>),
+         typename Cmp = std::less<>>
+void triple_pivot_quicksort(RandomIt first, RandomIt last, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{})
+{
+    detail::sort_presorted(first, last, cmp, [&](RandomIt begin, RandomIt end) {
+        detail::triple_pivot_loop(begin, end, pivot_func, cmp, 0);
+    });
+}
+
+// Rearranges the range like std::nth_element: *nth is the element a full
+// sort would put there, with nothing greater before it and nothing less
+// after it. Only the side holding nth is partitioned further, expected O(n).
+// Like introsort, a range still unresolved after 2*log2(n) steps is finished
+// with a heap based selection, which bounds the worst case to O(n log n).
+template<typename RandomIt,
+         typename Pivot_func = decltype(pivot::random<RandomIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way>
+void quickselect(RandomIt first, RandomIt nth, RandomIt last, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{})
+{
+    if (nth == last)
+        return;
+
+    for (auto depth_limit = 2 * detail::log2(last - first); !detail::sort_small_instances(first, last, cmp); --depth_limit)
+    {
+        if (depth_limit == 0)
+        {
+            std::partial_sort(first, std::next(nth), last, cmp);
+            return;
+        }
+
+        auto split = detail::partition_around_pivot(first, last, pivot_func, cmp, partition_func);
+        if (nth < split.lower)
+            last = split.lower;
+        else if (nth >= split.upper)
+            first = split.upper;
+        else
+            return;
+    }
+}
+
+// Sorts the middle - first smallest elements into [first, middle), leaving
+// the rest in unspecified order: a quickselect for middle then a quicksort
+// of the prefix, O(n + k log k).
+template<typename RandomIt,
+         typename Pivot_func = decltype(pivot::random<RandomIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way>
+void partial_quicksort(RandomIt first, RandomIt middle, RandomIt last, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{})
+{
+    quickselect(first, middle, last, pivot_func, cmp, partition_func);
+    sequential_quicksort(first, middle, pivot_func, cmp, partition_func);
+}
+
+// A range that is sorted on demand, for consumers that may stop after the
+// first few elements (ORDER BY ... LIMIT). Each step partitions the leftmost
+// pending subrange and keeps the parts right of the pivot pending on a
+// stack, so the first k elements in order cost O(n + k log k) rather than a
+// full sort. Elements right of sorted_end() are in unspecified order.
+template<typename RandomIt,
+         typename Pivot_func = decltype(pivot::random<RandomIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way>
+class lazy_sorted_range
+{
+public:
+    explicit lazy_sorted_range(RandomIt first, RandomIt last, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{})
+        : first_(first), sorted_end_(first), last_(last),
+          pivot_func_(pivot_func), cmp_(cmp), partition_func_(partition_func)
+    {
+        if (first != last)
+            pending_.emplace_back(first, last);
+    }
+
+    RandomIt begin() const
+    {
+        return first_;
+    }
+
+    RandomIt sorted_end() const
+    {
+        return sorted_end_;
+    }
+
+    RandomIt end() const
+    {
+        return last_;
+    }
+
+    bool done() const
+    {
+        return sorted_end_ == last_;
+    }
+
+    // Sorts at least count more elements, or all that are left, and returns
+    // the new end of the sorted prefix.
+    RandomIt extend(std::size_t count)
+    {
+        return sort_until(sorted_end_ + static_cast<std::ptrdiff_t>(std::min<std::size_t>(count, last_ - sorted_end_)));
+    }
+
+    // Sorts the prefix up to position, which is at most end().
+    RandomIt sort_until(RandomIt position)
+    {
+        while (sorted_end_ < position)
+        {
+            // everything between the sorted prefix and the top of the stack
+            // is pivots, already in their final place
+            if (pending_.empty())
+            {
+                sorted_end_ = last_;
+                break;
+            }
+
+            auto [first, last] = pending_.back();
+            sorted_end_ = first;
+            if (sorted_end_ >= position)
+                break;
+
+            if (detail::sort_small_instances(first, last, cmp_))
+            {
+                pending_.pop_back();
+                sorted_end_ = last;
+                continue;
+            }
+
+            auto split = detail::partition_around_pivot(first, last, pivot_func_, cmp_, partition_func_);
+            if (detail::split_sorted(first, last, split, cmp_))
+            {
+                pending_.pop_back();
+                sorted_end_ = last;
+                continue;
+            }
+
+            if (split.upper != last)
+                pending_.back().first = split.upper;
+            else
+                pending_.pop_back();
+            if (first != split.lower)
+                pending_.emplace_back(first, split.lower);
+        }
+        return sorted_end_;
+    }
+
+private:
+    RandomIt first_;
+    RandomIt sorted_end_;
+    RandomIt last_;
+    std::decay_t<Pivot_func> pivot_func_;
+    Cmp cmp_;
+    Partition_func partition_func_;
+    std::vector<std::pair<RandomIt, RandomIt>> pending_; // leftmost on top
+};
+
+// Sorts a fixed size array with the sorting network for N, fully unrolled at
+// compile time: no recursion, no size checks, no pivot selection. Being
+// constexpr it can also build sorted tables at compile time.
+template<typename T, std::size_t N, typename Cmp = std::less<>>
+constexpr void fixed_sort(std::array<T, N>& a, Cmp cmp = Cmp{})
+{
+    static_assert(N <= 256, "sorting network wires are indexed by unsigned char");
+    if constexpr (N > 1)
+        detail::network_sort<N>(a.begin(), cmp);
+}
+
+// Sorted copy, for constexpr tables.
+template<typename T, std::size_t N, typename Cmp = std::less<>>
+constexpr std::array<T, N> fixed_sorted(std::array<T, N> a, Cmp cmp = Cmp{})
+{
+    fixed_sort(a, cmp);
+    return a;
+}
+
+#ifdef __cpp_lib_span
+template<typename T, std::size_t N, typename Cmp = std::less<>,
+         typename = std::enable_if_t<N != std::dynamic_extent>>
+constexpr void fixed_sort(std::span<T, N> s, Cmp cmp = Cmp{})
+{
+    static_assert(N <= 256, "sorting network wires are indexed by unsigned char");
+    if constexpr (N > 1)
+        detail::network_sort<N>(s.begin(), cmp);
+}
+#endif
+
+namespace detail
+{
+
+// Threads a pooled sort may occupy under the policy.
+inline std::size_t thread_budget(const parallel::cutoff_policy& policy, const parallel::thread_pool& pool)
+{
+    return policy.workers ? std::min(policy.workers, pool.size()) : pool.size();
+}
+
+// Share of a budget of threads handed to the left side of a fork, in
+// proportion to its size, leaving at least one thread on either side.
+template<typename Size>
+std::size_t left_share(std::size_t threads, Size left, Size right)
+{
+    const auto share = static_cast<std::size_t>(static_cast<double>(threads) * left / (left + right));
+    return std::min(std::max<std::size_t>(share, 1), threads - 1);
+}
+
+// threads is the number of threads this subrange may still occupy. Each fork
+// hands the two sides a share proportional to their size, so lopsided
+// partitions do not leave cores idle and tiny ranges never spawn a thread.
+template<typename BiIt, typename Pivot_func, typename Cmp, typename Partition_func>
+void naive_parallel_loop(BiIt first, BiIt last, std::size_t threads, std::ptrdiff_t grain_size, Pivot_func pivot_func, Cmp cmp, Partition_func partition_func, std::size_t depth)
+{
+    const auto size = std::distance(first, last);
+    if (threads < 2 || size < std::max<std::ptrdiff_t>(grain_size, 2))
+    {
+        sequential_sort(first, last, pivot_func, cmp, partition_func, depth);
+        return;
+    }
+
+    const auto started = start_step(cmp);
+    auto split = partition_around_pivot(first, last, pivot_func, cmp, partition_func);
+    const auto left = std::distance(first, split.lower);
+    const auto right = std::distance(split.upper, last);
+    note_partition(cmp, depth, left, right, started);
+    if (left + right == 0)
+        return;
+
+    const auto left_threads = left_share(threads, left, right);
+
+    std::thread t1([=]() {
+        naive_parallel_loop(first, split.lower, left_threads, grain_size, pivot_func, cmp, partition_func, depth + 1);
+    });
+
+    naive_parallel_loop(split.upper, last, threads - left_threads, grain_size, pivot_func, cmp, partition_func, depth + 1);
+    t1.join();
+}
+
+} // namespace detail
+
+template<typename BiIt,
+         typename Pivot_func = decltype(pivot::random<BiIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way>
+void naive_parallel_quicksort(BiIt first, BiIt last, parallel::cutoff_policy policy = {}, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{})
+{
+    const auto threads = policy.workers ? policy.workers : std::max(1u, std::thread::hardware_concurrency());
+    detail::naive_parallel_loop(first, last, threads, policy.grain_size, pivot_func, cmp, partition_func, 0);
+}
+
+namespace detail
+{
+
+// Ranges at least this large are partitioned by all workers together, in
+// chunks of at least parallel_partition_min_chunk elements.
+constexpr std::ptrdiff_t parallel_partition_threshold = 1 << 18;
+constexpr std::ptrdiff_t parallel_partition_min_chunk = 1 << 15;
+
+template<typename RandomIt, typename T, typename Cmp>
+RandomIt partition_chunk(RandomIt first, RandomIt last, const T& pivot, Cmp cmp)
+{
+    if constexpr (simd::is_supported<RandomIt, Cmp>)
+    {
+        auto data = std::addressof(*first);
+        return first + (simd::partition(data, data + (last - first), pivot).first - data);
+    }
+    else
+    {
+        return hole_partition(first, last, pivot, cmp).first;
+    }
+}
+
+// Blocked parallel partition: every chunk is partitioned on its own, then
+// the elements that ended up on the wrong side of the global split point are
+// swapped across in parallel. Both sets of misplaced elements have the same
+// size, so the swap work is split evenly between the workers.
+template<typename RandomIt, typename T, typename Cmp>
+RandomIt parallel_partition(RandomIt first, RandomIt last, const T& pivot, Cmp cmp, parallel::thread_pool& pool, std::size_t workers)
+{
+    using interval = std::pair<std::ptrdiff_t, std::ptrdiff_t>;
+
+    const auto size = last - first;
+    const auto chunks = std::max<std::ptrdiff_t>(1, std::min<std::ptrdiff_t>(workers, size / parallel_partition_min_chunk));
+
+    std::vector<std::ptrdiff_t> bounds(chunks + 1), splits(chunks);
+    for (std::ptrdiff_t i = 0; i <= chunks; ++i)
+        bounds[i] = size * i / chunks;
+
+    parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+        splits[i] = partition_chunk(first + bounds[i], first + bounds[i + 1], pivot, cmp) - first;
+    });
+
+    auto middle = std::ptrdiff_t(0);
+    for (std::ptrdiff_t i = 0; i < chunks; ++i)
+        middle += splits[i] - bounds[i];
+
+    // not-less elements left of middle and less elements right of it
+    std::vector<interval> wrong_left, wrong_right;
+    for (std::ptrdiff_t i = 0; i < chunks; ++i)
+    {
+        if (splits[i] < std::min(bounds[i + 1], middle))
+            wrong_left.emplace_back(splits[i], std::min(bounds[i + 1], middle));
+        if (std::max(bounds[i], middle) < splits[i])
+            wrong_right.emplace_back(std::max(bounds[i], middle), splits[i]);
+    }
+
+    std::vector<std::ptrdiff_t> prefix_left(1, 0), prefix_right(1, 0);
+    for (const auto& i : wrong_left)
+        prefix_left.push_back(prefix_left.back() + i.second - i.first);
+    for (const auto& i : wrong_right)
+        prefix_right.push_back(prefix_right.back() + i.second - i.first);
+
+    const auto misplaced = prefix_left.back();
+    if (misplaced > 0)
+    {
+        // position of the k-th misplaced element of a side
+        auto locate = [](const std::vector<interval>& intervals, const std::vector<std::ptrdiff_t>& prefix, std::ptrdiff_t k) {
+            const auto index = std::upper_bound(prefix.begin(), prefix.end(), k) - prefix.begin() - 1;
+            return std::make_pair(index, intervals[index].first + (k - prefix[index]));
+        };
+
+        parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+            const auto begin = misplaced * i / chunks;
+            const auto end = misplaced * (i + 1) / chunks;
+            if (begin == end)
+                return;
+
+            auto l = locate(wrong_left, prefix_left, begin);
+            auto r = locate(wrong_right, prefix_right, begin);
+            for (auto k = begin; k < end; ++k)
+            {
+                std::iter_swap(first + l.second, first + r.second);
+                if (++l.second == wrong_left[l.first].second && k + 1 < end)
+                    l.second = wrong_left[++l.first].first;
+                if (++r.second == wrong_right[r.first].second && k + 1 < end)
+                    r.second = wrong_right[++r.first].first;
+            }
+            note_swaps(cmp, static_cast<std::size_t>(end - begin));
+        });
+    }
+
+    return first + middle;
+}
+
+// Only schemes that split by "less than pivot" can be replaced by the
+// parallel partition without changing what the caller gets back.
+template<typename Partition_func>
+constexpr bool splits_by_less = std::is_same<Partition_func, partition::two_way>::value
+    || std::is_same<Partition_func, partition::block>::value;
+
+template<typename BiIt, typename Pivot_func, typename Cmp, typename Partition_func>
+partition::result<BiIt> pool_partition_step(BiIt first, BiIt last, parallel::thread_pool& pool, std::size_t workers, Pivot_func pivot_func, Cmp cmp, Partition_func partition_func)
+{
+    using category = typename std::iterator_traits<BiIt>::iterator_category;
+
+    if constexpr (std::is_base_of<std::random_access_iterator_tag, category>::value && splits_by_less<Partition_func>)
+    {
+        if (workers > 1 && last - first >= parallel_partition_threshold)
+        {
+            std::iter_swap(first, choose_pivot(pivot_func, first, last, cmp));
+            note_swaps(cmp, 1);
+            auto greater_than_pivot = parallel_partition(std::next(first), last, *first, cmp, pool, workers);
+
+            auto pivot = std::prev(greater_than_pivot);
+            if (pivot == first)
+                return {first, gather_minimum(first, last, cmp).first};
+            std::iter_swap(pivot, first);
+            note_swaps(cmp, 1);
+            return {pivot, greater_than_pivot};
+        }
+    }
+
+    return partition_around_pivot(first, last, pivot_func, cmp, partition_func);
+}
+
+// threads is the number of threads this subrange may still occupy, as in
+// naive_parallel_loop; once it is down to one the rest is sorted inline.
+template<typename BiIt, typename Pivot_func, typename Cmp, typename Partition_func>
+void pool_quicksort_task(BiIt first, BiIt last, parallel::task_group& tasks, const parallel::cutoff_policy& policy, std::size_t threads, Pivot_func pivot_func, Cmp cmp, Partition_func partition_func, std::size_t depth)
+{
+    for (; threads > 1 && std::distance(first, last) >= std::max<std::ptrdiff_t>(policy.grain_size, 2); ++depth)
+    {
+        const auto started = start_step(cmp);
+        auto split = pool_partition_step(first, last, tasks.pool(), threads, pivot_func, cmp, partition_func);
+        const auto left = std::distance(first, split.lower);
+        const auto right = std::distance(split.upper, last);
+        note_partition(cmp, depth, left, right, started);
+
+        if (left > 0)
+        {
+            const auto left_last = split.lower;
+            const auto left_threads = left_share(threads, left, right);
+            tasks.run([=, &tasks, &policy]() {
+                pool_quicksort_task(first, left_last, tasks, policy, left_threads, pivot_func, cmp, partition_func, depth + 1);
+            });
+            threads -= left_threads;
+        }
+
+        first = split.upper;
+    }
+
+    sequential_sort(first, last, pivot_func, cmp, partition_func, depth);
+}
+
+} // namespace detail
+
+template<typename BiIt,
+         typename Pivot_func = decltype(pivot::random<BiIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way,
+         typename = std::enable_if_t<!detail::is_projection<Pivot_func, BiIt>>>
+void pool_parallel_quicksort(BiIt first, BiIt last, parallel::thread_pool& pool, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{}, parallel::cutoff_policy policy = {})
+{
+    parallel::task_group tasks(pool);
+    detail::pool_quicksort_task(first, last, tasks, policy, detail::thread_budget(policy, pool), pivot_func, cmp, partition_func, 0);
+    tasks.wait();
+}
+
+template<typename BiIt,
+         typename Pivot_func = decltype(pivot::random<BiIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way,
+         typename = std::enable_if_t<!detail::is_projection<Pivot_func, BiIt>>>
+void pool_parallel_quicksort(BiIt first, BiIt last, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{}, parallel::cutoff_policy policy = {})
+{
+    pool_parallel_quicksort(first, last, parallel::default_pool(), pivot_func, cmp, partition_func, policy);
+}
+
+namespace detail
+{
+
+template<typename Ranges>
+using batch_iterator_t = decltype(std::begin(*std::begin(std::declval<Ranges&>())));
+
+} // namespace detail
+
+// Sorts every range in ranges, a container of independent ranges such as a
+// vector of vectors, on the pool. Ranges below the grain size are grouped
+// into tasks of about grain_size elements, each sorted sequentially by one
+// thread; larger ones are forked further like pool_parallel_quicksort does,
+// so one oversized range does not keep a single worker busy while the
+// others idle.
+template<typename Ranges,
+         typename Pivot_func = decltype(pivot::random<detail::batch_iterator_t<Ranges>>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way>
+void batch_sort(Ranges& ranges, parallel::thread_pool& pool, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{}, parallel::cutoff_policy policy = {})
+{
+    using outer_iterator = decltype(std::begin(ranges));
+
+    const auto grain_size = std::max<std::ptrdiff_t>(policy.grain_size, 2);
+    const auto is_small = [grain_size](auto& range) {
+        return std::distance(std::begin(range), std::end(range)) < grain_size;
+    };
+
+    parallel::task_group tasks(pool);
+    const auto run_batch = [&](outer_iterator batch_first, outer_iterator batch_last) {
+        tasks.run([=]() mutable {
+            for (auto it = batch_first; it != batch_last; ++it)
+            {
+                if (is_small(*it))
+                    detail::sequential_sort(std::begin(*it), std::end(*it), pivot_func, cmp, partition_func, 0);
+            }
+        });
+    };
+
+    auto batch_first = std::begin(ranges);
+    std::ptrdiff_t batch_size = 0;
+    for (auto it = std::begin(ranges); it != std::end(ranges); ++it)
+    {
+        const auto size = std::distance(std::begin(*it), std::end(*it));
+        if (size >= grain_size)
+        {
+            tasks.run([=, &tasks, &policy]() {
+                detail::pool_quicksort_task(std::begin(*it), std::end(*it), tasks, policy, detail::thread_budget(policy, tasks.pool()), pivot_func, cmp, partition_func, 0);
+            });
+            continue;
+        }
+
+        batch_size += size;
+        if (batch_size >= grain_size)
+        {
+            run_batch(batch_first, std::next(it));
+            batch_first = std::next(it);
+            batch_size = 0;
+        }
+    }
+    if (batch_first != std::end(ranges))
+        run_batch(batch_first, std::end(ranges));
+
+    tasks.wait();
+}
+
+template<typename Ranges,
+         typename Pivot_func = decltype(pivot::random<detail::batch_iterator_t<Ranges>>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way>
+void batch_sort(Ranges& ranges, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{}, parallel::cutoff_policy policy = {})
+{
+    batch_sort(ranges, parallel::default_pool(), pivot_func, cmp, partition_func, policy);
+}
+
+namespace parallel
+{
+
+enum class sort_status
+{
+    completed,
+    cancelled // stopped early, the range holds a permutation of the input
+};
+
+// Shared between a running async sort and its sort_future.
+struct async_sort_state
+{
+    std::atomic<std::size_t> finalized{0};
+    std::atomic<bool> skipped{false};
+    std::size_t size = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    std::exception_ptr error;
+    std::function<void()> continuation;
+
+    void finish(std::exception_ptr failure)
+    {
+        std::function<void()> next;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+            error = failure;
+            next = std::move(continuation);
+        }
+        cv.notify_all();
+        if (next)
+            next();
+    }
+};
+
+// Handle on a sort running on a pool. Reports how many elements have reached
+// their final position so far, can be waited on and, in C++20, co_awaited;
+// the awaiting coroutine is resumed on the worker that finishes the sort.
+class sort_future
+{
+public:
+    sort_future() = default;
+
+    explicit sort_future(std::shared_ptr<async_sort_state> state) : state_(std::move(state)) {}
+
+    bool valid() const
+    {
+        return state_ != nullptr;
+    }
+
+    // Elements in their final position, size() once the sort is complete.
+    std::size_t finalized() const
+    {
+        return state_->finalized.load(std::memory_order_relaxed);
+    }
+
+    std::size_t size() const
+    {
+        return state_->size;
+    }
+
+    bool ready() const
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        return state_->done;
+    }
+
+    void wait() const
+    {
+        std::unique_lock<std::mutex> lock(state_->mutex);
+        state_->cv.wait(lock, [this]() { return state_->done; });
+    }
+
+    template<typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout) const
+    {
+        std::unique_lock<std::mutex> lock(state_->mutex);
+        return state_->cv.wait_for(lock, timeout, [this]() { return state_->done; });
+    }
+
+    // Waits, then rethrows what the comparator threw, if anything.
+    sort_status get() const
+    {
+        wait();
+        if (state_->error)
+            std::rethrow_exception(state_->error);
+        return state_->skipped.load(std::memory_order_relaxed) ? sort_status::cancelled : sort_status::completed;
+    }
+
+#if QUICKSORT_HAS_COROUTINES
+    auto operator co_await() const
+    {
+        struct awaiter
+        {
+            const sort_future& future;
+
+            bool await_ready() const
+            {
+                return future.ready();
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle) const
+            {
+                std::lock_guard<std::mutex> lock(future.state_->mutex);
+                if (future.state_->done)
+                    return false;
+                future.state_->continuation = [handle]() { handle.resume(); };
+                return true;
+            }
+
+            sort_status await_resume() const
+            {
+                return future.get();
+            }
+        };
+        return awaiter{*this};
+    }
+#endif
+
+private:
+    std::shared_ptr<async_sort_state> state_;
+};
+
+} // namespace parallel
+
+namespace detail
+{
+
+// pool_quicksort_task with a stop check before every partition step and a
+// count of the elements each step or leaf sort leaves in their final place.
+// Ranges above the grain size are still partitioned step by step once the
+// thread budget is used up, only without forking.
+template<typename BiIt, typename Pivot_func, typename Cmp, typename Partition_func, typename Stop_token>
+void async_quicksort_task(BiIt first, BiIt last, parallel::task_group& tasks, const parallel::cutoff_policy& policy, std::size_t threads, Pivot_func pivot_func, Cmp cmp, Partition_func partition_func, const Stop_token& token, parallel::async_sort_state& progress, std::size_t depth)
+{
+    for (; std::distance(first, last) >= std::max<std::ptrdiff_t>(policy.grain_size, 2); ++depth)
+    {
+        if (token.stop_requested())
+        {
+            progress.skipped.store(true, std::memory_order_relaxed);
+            return;
+        }
+
+        const auto started = start_step(cmp);
+        auto split = pool_partition_step(first, last, tasks.pool(), threads, pivot_func, cmp, partition_func);
+        const auto left = std::distance(first, split.lower);
+        const auto right = std::distance(split.upper, last);
+        note_partition(cmp, depth, left, right, started);
+        progress.finalized.fetch_add(static_cast<std::size_t>(std::distance(split.lower, split.upper)), std::memory_order_relaxed);
+
+        if (threads > 1 && left > 0)
+        {
+            const auto left_last = split.lower;
+            const auto left_threads = left_share(threads, left, right);
+            tasks.run([=, &tasks, &policy, &token, &progress]() {
+                async_quicksort_task(first, left_last, tasks, policy, left_threads, pivot_func, cmp, partition_func, token, progress, depth + 1);
+            });
+            threads -= left_threads;
+            first = split.upper;
+        }
+        else if (left < right)
+        {
+            // out of threads: keep partitioning inline so the token is still
+            // checked at every step
+            async_quicksort_task(first, split.lower, tasks, policy, 1, pivot_func, cmp, partition_func, token, progress, depth + 1);
+            first = split.upper;
+        }
+        else
+        {
+            async_quicksort_task(split.upper, last, tasks, policy, 1, pivot_func, cmp, partition_func, token, progress, depth + 1);
+            last = split.lower;
+        }
+    }
+
+    if (token.stop_requested())
+    {
+        progress.skipped.store(true, std::memory_order_relaxed);
+        return;
+    }
+    sequential_sort(first, last, pivot_func, cmp, partition_func, depth);
+    progress.finalized.fetch_add(static_cast<std::size_t>(std::distance(first, last)), std::memory_order_relaxed);
+}
+
+} // namespace detail
+
+// Starts pool_parallel_quicksort on the pool and returns at once. The token
+// is checked before every partition step, so a stop request ends the sort
+// within about one step per worker; the range must stay alive until the
+// returned future is ready.
+template<typename BiIt,
+         typename Pivot_func = decltype(pivot::random<BiIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way,
+         typename Stop_token = parallel::stop_token>
+parallel::sort_future async_quicksort(BiIt first, BiIt last, parallel::thread_pool& pool, Stop_token token = Stop_token{}, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{}, parallel::cutoff_policy policy = {})
+{
+    auto state = std::make_shared<parallel::async_sort_state>();
+    state->size = static_cast<std::size_t>(std::distance(first, last));
+
+    pool.submit([=, &pool]() {
+        std::exception_ptr error;
+        try
+        {
+            parallel::task_group tasks(pool);
+            detail::async_quicksort_task(first, last, tasks, policy, detail::thread_budget(policy, pool), pivot_func, cmp, partition_func, token, *state, 0);
+            tasks.wait();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        state->finish(error);
+    });
+    return parallel::sort_future(state);
+}
+
+template<typename BiIt,
+         typename Pivot_func = decltype(pivot::random<BiIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way,
+         typename Stop_token = parallel::stop_token>
+parallel::sort_future async_quicksort(BiIt first, BiIt last, Stop_token token = Stop_token{}, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{}, parallel::cutoff_policy policy = {})
+{
+    return async_quicksort(first, last, parallel::default_pool(), token, pivot_func, cmp, partition_func, policy);
+}
+
+namespace detail
+{
+
+// Smallest slice of the input a worker preselects candidates from.
+constexpr std::ptrdiff_t parallel_select_min_chunk = 1 << 15;
+
+} // namespace detail
+
+// Parallel top-k: every worker quickselects the k smallest elements of its
+// slice, the candidates are gathered at the front and the sequential
+// partial_quicksort finishes on them, touching only k * workers elements.
+// When k is a large share of the input a parallel quicksort of the selected
+// prefix does the work instead.
+template<typename RandomIt,
+         typename Pivot_func = decltype(pivot::random<RandomIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way>
+void parallel_partial_quicksort(RandomIt first, RandomIt middle, RandomIt last, parallel::thread_pool& pool, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{})
+{
+    const auto size = last - first;
+    const auto k = middle - first;
+    const auto chunks = std::max<std::ptrdiff_t>(1, std::min<std::ptrdiff_t>(pool.size(), size / detail::parallel_select_min_chunk));
+
+    if (chunks == 1 || 2 * k * chunks > size)
+    {
+        quickselect(first, middle, last, pivot_func, cmp, partition_func);
+        pool_parallel_quicksort(first, middle, pool, pivot_func, cmp, partition_func);
+        return;
+    }
+
+    auto chunk_begin = [first, size, chunks](std::ptrdiff_t i) { return first + size * i / chunks; };
+    parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+        quickselect(chunk_begin(i), chunk_begin(i) + k, chunk_begin(i + 1), pivot_func, cmp, partition_func);
+    });
+
+    // every slice holds at least 2k elements, so the candidates of a slice
+    // only ever move into earlier, non-candidate positions
+    auto candidates = first + k;
+    for (std::ptrdiff_t i = 1; i < chunks; ++i)
+        candidates = std::swap_ranges(chunk_begin(i), chunk_begin(i) + k, candidates);
+
+    partial_quicksort(first, middle, candidates, pivot_func, cmp, partition_func);
+}
+
+template<typename RandomIt,
+         typename Pivot_func = decltype(pivot::random<RandomIt>),
+         typename Cmp = std::less<>,
+         typename Partition_func = partition::two_way>
+void parallel_partial_quicksort(RandomIt first, RandomIt middle, RandomIt last, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{}, Partition_func partition_func = Partition_func{})
+{
+    parallel_partial_quicksort(first, middle, last, parallel::default_pool(), pivot_func, cmp, partition_func);
+}
+
+namespace detail
+{
+
+// Raw storage for n elements; constructing and destroying them is up to the
+// user, which lets the workers do both in parallel.
+template<typename T>
+class uninitialized_buffer
+{
+public:
+    explicit uninitialized_buffer(std::size_t size)
+        : data_(std::allocator<T>().allocate(size)), size_(size)
+    {
+    }
+
+    uninitialized_buffer(const uninitialized_buffer&) = delete;
+    uninitialized_buffer& operator=(const uninitialized_buffer&) = delete;
+
+    ~uninitialized_buffer()
+    {
+        std::allocator<T>().deallocate(data_, size_);
+    }
+
+    T* data() const
+    {
+        return data_;
+    }
+
+private:
+    T* data_;
+    std::size_t size_;
+};
+
+// Below this size samplesort hands the range to the sequential quicksort.
+constexpr std::ptrdiff_t samplesort_threshold = 1 << 16;
+constexpr std::size_t samplesort_max_buckets = 256;
+constexpr std::size_t samplesort_oversampling = 32;
+
+// Draws buckets * samplesort_oversampling elements and returns iterators to
+// buckets - 1 evenly spaced ones among them, in sorted order. Only the
+// iterators are sorted, so the elements are neither copied nor moved.
+template<typename RandomIt, typename Cmp>
+std::vector<RandomIt> draw_splitters(RandomIt first, RandomIt last, std::size_t buckets, Cmp& cmp)
+{
+    std::vector<RandomIt> sample;
+    sample.reserve(buckets * samplesort_oversampling);
+    for (std::size_t i = 0; i < buckets * samplesort_oversampling; ++i)
+        sample.push_back(first + bounded_random(thread_rng(), last - first));
+
+    auto by_value = [&cmp](RandomIt a, RandomIt b) { return cmp(*a, *b); };
+    sequential_quicksort(sample.begin(), sample.end(), pivot::random<typename std::vector<RandomIt>::iterator>, by_value);
+
+    std::vector<RandomIt> splitters;
+    splitters.reserve(buckets - 1);
+    for (std::size_t i = 1; i < buckets; ++i)
+        splitters.push_back(sample[i * samplesort_oversampling - 1]);
+    return splitters;
+}
+
+// Splitters stored as an implicit binary search tree: node j has children
+// 2j and 2j+1. Classifying walks log2(k) levels without a data dependent
+// branch, the comparison result is the next index bit. The tree holds
+// iterators to the splitters, which must stay in place while it is used.
+//
+// If the sample repeats a splitter, keys are heavily duplicated and one
+// bucket would take most of the input. Every bucket is then followed by an
+// equality bucket for the keys equal to its splitter, as in IPS4o, which
+// needs no further sorting; one extra comparison per element finds it.
+template<typename It, typename Cmp>
+class splitter_tree
+{
+public:
+    using value_type = typename std::iterator_traits<It>::value_type;
+
+    splitter_tree(std::vector<It> sorted_splitters, Cmp cmp)
+        : levels_(log2(sorted_splitters.size() + 1)), cmp_(cmp),
+          tree_(sorted_splitters.size() + 1, sorted_splitters.front()), // slot 0 unused
+          splitters_(std::move(sorted_splitters))
+    {
+        build(splitters_, tree_, 1, 0, splitters_.size());
+        for (std::size_t i = 1; i < splitters_.size(); ++i)
+            equal_buckets_ = equal_buckets_ || !cmp_(*splitters_[i - 1], *splitters_[i]);
+    }
+
+    std::size_t buckets() const
+    {
+        return equal_buckets_ ? 2 * tree_.size() - 1 : tree_.size();
+    }
+
+    // Whether bucket holds keys equal to its splitter only.
+    bool is_equal_bucket(std::size_t bucket) const
+    {
+        return equal_buckets_ && bucket % 2 == 1;
+    }
+
+    std::size_t classify(const value_type& value) const
+    {
+        std::size_t j = 1;
+        for (int level = 0; level < levels_; ++level)
+            j = 2 * j + static_cast<std::size_t>(cmp_(*tree_[j], value));
+
+        const auto bucket = j - tree_.size();
+        if (!equal_buckets_)
+            return bucket;
+        return 2 * bucket + static_cast<std::size_t>(bucket < splitters_.size() && !cmp_(value, *splitters_[bucket]));
+    }
+
+private:
+    static void build(const std::vector<It>& sorted, std::vector<It>& nodes, std::size_t node, std::size_t lo, std::size_t hi)
+    {
+        if (lo >= hi)
+            return;
+
+        const auto mid = lo + (hi - lo) / 2;
+        nodes[node] = sorted[mid];
+        build(sorted, nodes, 2 * node, lo, mid);
+        build(sorted, nodes, 2 * node + 1, mid + 1, hi);
+    }
+
+    int levels_;
+    Cmp cmp_;
+    std::vector<It> tree_;
+    std::vector<It> splitters_;
+    bool equal_buckets_ = false;
+};
+
+} // namespace detail
+
+// Parallel super scalar samplesort: k-1 splitters drawn from an oversampled
+// set split the input into k buckets in one classification and one scatter
+// pass, then every bucket is sorted by sequential_quicksort on the pool. All
+// workers are busy after the first pass instead of after log2(p) levels.
+// The splitters are compared where they lie, so elements are only moved.
+template<typename RandomIt, typename Cmp = std::less<>>
+void parallel_samplesort(RandomIt first, RandomIt last, parallel::thread_pool& pool, Cmp cmp = Cmp{})
+{
+    using value_type = typename std::iterator_traits<RandomIt>::value_type;
+
+    const auto size = last - first;
+    if (pool.size() < 2 || size < detail::samplesort_threshold)
+    {
+        sequential_quicksort(first, last, pivot::random<RandomIt>, cmp);
+        return;
+    }
+
+    // key ranges: power of two, a few per worker for load balance
+    std::size_t ranges = 2;
+    while (ranges < 4 * pool.size() && ranges < detail::samplesort_max_buckets)
+        ranges *= 2;
+
+    const detail::splitter_tree<RandomIt, Cmp> tree(detail::draw_splitters(first, last, ranges, cmp), cmp);
+    const auto buckets = tree.buckets();
+
+    const auto chunks = static_cast<std::ptrdiff_t>(pool.size());
+    auto chunk_begin = [size, chunks](std::ptrdiff_t i) { return size * i / chunks; };
+
+    detail::uninitialized_buffer<value_type> buffer(size);
+    std::vector<std::uint16_t> bucket_of(size);
+    std::vector<std::ptrdiff_t> offsets(chunks * buckets);
+
+    // classify in place, the splitters are still part of the input
+    parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+        auto counts = offsets.begin() + i * buckets;
+        for (auto j = chunk_begin(i); j < chunk_begin(i + 1); ++j)
+        {
+            const auto bucket = tree.classify(first[j]);
+            bucket_of[j] = static_cast<std::uint16_t>(bucket);
+            ++counts[bucket];
+        }
+    });
+
+    // bucket-major exclusive prefix sum over the chunk histograms
+    std::vector<std::ptrdiff_t> bucket_begin(buckets + 1);
+    auto sum = std::ptrdiff_t(0);
+    for (std::size_t b = 0; b < buckets; ++b)
+    {
+        bucket_begin[b] = sum;
+        for (std::ptrdiff_t i = 0; i < chunks; ++i)
+        {
+            const auto count = offsets[i * buckets + b];
+            offsets[i * buckets + b] = sum;
+            sum += count;
+        }
+    }
+    bucket_begin[buckets] = sum;
+
+    // scatter into the buffer, then move it back
+    parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+        auto positions = offsets.begin() + i * buckets;
+        for (auto j = chunk_begin(i); j < chunk_begin(i + 1); ++j)
+            ::new (static_cast<void*>(buffer.data() + positions[bucket_of[j]]++)) value_type(std::move(first[j]));
+    });
+    parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+        const auto begin = chunk_begin(i);
+        const auto end = chunk_begin(i + 1);
+        std::move(buffer.data() + begin, buffer.data() + end, first + begin);
+        std::destroy(buffer.data() + begin, buffer.data() + end);
+    });
+
+    parallel::task_group tasks(pool);
+    for (std::size_t b = 0; b < buckets; ++b)
+    {
+        if (tree.is_equal_bucket(b))
+            continue;
+
+        const auto bucket_first = first + bucket_begin[b];
+        const auto bucket_last = first + bucket_begin[b + 1];
+        tasks.run([bucket_first, bucket_last, cmp]() {
+            sequential_quicksort(bucket_first, bucket_last, pivot::random<RandomIt>, cmp);
+        });
+    }
+    tasks.wait();
+}
+
+template<typename RandomIt, typename Cmp = std::less<>>
+void parallel_samplesort(RandomIt first, RandomIt last, Cmp cmp = Cmp{})
+{
+    parallel_samplesort(first, last, parallel::default_pool(), cmp);
+}
+
+// NUMA placement for the parallel sorts. On Linux the node layout is read
+// from sysfs and workers can be pinned to the CPUs of one node; elsewhere,
+// or when sysfs is unavailable, the machine is treated as a single node.
+namespace numa
+{
+
+// CPUs of every node, in node order. An empty CPU list means the node's
+// CPUs are unknown and its workers are not pinned.
+struct topology
+{
+    std::vector<std::vector<int>> nodes;
+};
+
+namespace detail
+{
+
+// Parses a sysfs CPU list such as "0-3,8-11".
+inline std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    const char* p = list.c_str();
+    while (*p)
+    {
+        char* end;
+        const auto lo = std::strtol(p, &end, 10);
+        if (end == p)
+            break;
+        auto hi = lo;
+        if (*end == '-')
+        {
+            p = end + 1;
+            hi = std::strtol(p, &end, 10);
+        }
+        for (auto cpu = lo; cpu <= hi; ++cpu)
+            cpus.push_back(static_cast<int>(cpu));
+        p = *end == ',' ? end + 1 : end;
+    }
+    return cpus;
+}
+
+inline std::string read_line(const std::string& path)
+{
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+} // namespace detail
+
+inline topology discover_topology()
+{
+    topology result;
+    for (auto node : detail::parse_cpu_list(detail::read_line("/sys/devices/system/node/online")))
+    {
+        auto cpus = detail::parse_cpu_list(detail::read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+        if (!cpus.empty()) // memory only nodes have no workers to run
+            result.nodes.push_back(std::move(cpus));
+    }
+    if (result.nodes.empty())
+        result.nodes.emplace_back();
+    return result;
+}
+
+inline const topology& system_topology()
+{
+    static const topology nodes = discover_topology();
+    return nodes;
+}
+
+// Restricts the calling thread to the given CPUs, returns false if that is
+// not supported or failed.
+inline bool pin_current_thread(const std::vector<int>& cpus)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus)
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+// One pool per node with a worker per CPU of the node, each pinned to that
+// node. Memory a worker touches first is placed on its node by the kernel.
+class node_pools
+{
+public:
+    explicit node_pools(const topology& layout = system_topology())
+    {
+        for (const auto& cpus : layout.nodes)
+        {
+            const auto workers = cpus.empty() ? std::max(1u, std::thread::hardware_concurrency()) : cpus.size();
+            pools_.push_back(std::make_unique<parallel::thread_pool>(workers, [cpus](std::size_t) {
+                pin_current_thread(cpus);
+            }));
+        }
+    }
+
+    std::size_t nodes() const
+    {
+        return pools_.size();
+    }
+
+    parallel::thread_pool& pool(std::size_t node) const
+    {
+        return *pools_[node];
+    }
+
+    std::size_t workers() const
+    {
+        std::size_t result = 0;
+        for (const auto& pool : pools_)
+            result += pool->size();
+        return result;
+    }
+
+    // Runs func(node, i) for every node and every i below per_node on the
+    // workers of that node, and blocks until all of them are done. Unlike
+    // task_group::wait the caller does not help, so no work leaves its node.
+    template<typename Func>
+    void run(std::size_t per_node, Func func) const
+    {
+        std::mutex mutex;
+        std::condition_variable done;
+        std::size_t outstanding = nodes() * per_node;
+        std::exception_ptr error;
+
+        for (std::size_t node = 0; node < nodes(); ++node)
+        {
+            for (std::size_t i = 0; i < per_node; ++i)
+            {
+                pool(node).submit([&, node, i]() {
+                    std::exception_ptr failure;
+                    try
+                    {
+                        func(node, i);
+                    }
+                    catch (...)
+                    {
+                        failure = std::current_exception();
+                    }
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (failure && !error)
+                        error = failure;
+                    if (--outstanding == 0)
+                        done.notify_one();
+                });
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&outstanding]() { return outstanding == 0; });
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    std::vector<std::unique_ptr<parallel::thread_pool>> pools_;
+};
+
+inline node_pools& default_node_pools()
+{
+    static node_pools pools;
+    return pools;
+}
+
+} // namespace numa
+
+// Samplesort that keeps every node on its own memory. The input is split
+// into one slice per worker, classified by the node the slice belongs to,
+// and buckets are assigned to nodes in contiguous key ranges of about equal
+// element count. Each node then gathers its buckets into a buffer its own
+// workers touch first, so the buffer is node local, sorts them there and
+// finally moves them back. Data crosses nodes only in the gather and in the
+// move back. With a single node this is pool_parallel_quicksort.
+template<typename RandomIt, typename Cmp = std::less<>>
+void numa_samplesort(RandomIt first, RandomIt last, const numa::node_pools& pools, Cmp cmp = Cmp{})
+{
+    using value_type = typename std::iterator_traits<RandomIt>::value_type;
+
+    const auto size = last - first;
+    const auto nodes = pools.nodes();
+    if (nodes < 2 || size < detail::samplesort_threshold)
+    {
+        pool_parallel_quicksort(first, last, pools.pool(0), pivot::random<RandomIt>, cmp);
+        return;
+    }
+
+    // enough key ranges that whole buckets split the input evenly across nodes
+    std::size_t ranges = 2;
+    while (ranges < 16 * nodes && ranges < detail::samplesort_max_buckets)
+        ranges *= 2;
+
+    const detail::splitter_tree<RandomIt, Cmp> tree(detail::draw_splitters(first, last, ranges, cmp), cmp);
+    const auto buckets = tree.buckets();
+
+    // slice s of the input is classified by a worker of node s * nodes / slices
+    std::vector<std::size_t> slices_begin(nodes + 1);
+    const auto slices = pools.workers();
+    for (std::size_t node = 0, s = 0; node < nodes; ++node)
+    {
+        slices_begin[node] = s;
+        s += pools.pool(node).size();
+    }
+    slices_begin[nodes] = slices;
+    auto slice_begin = [size, slices](std::size_t s) { return static_cast<std::ptrdiff_t>(size * s / slices); };
+
+    std::vector<std::uint16_t> bucket_of(size);
+    std::vector<std::ptrdiff_t> offsets(slices * buckets);
+
+    pools.run(1, [&](std::size_t node, std::size_t) {
+        parallel::for_each_index(pools.pool(node), slices_begin[node + 1] - slices_begin[node], [&](std::size_t i) {
+            const auto s = slices_begin[node] + i;
+            auto counts = offsets.begin() + s * buckets;
+            for (auto j = slice_begin(s); j < slice_begin(s + 1); ++j)
+            {
+                const auto bucket = tree.classify(first[j]);
+                bucket_of[j] = static_cast<std::uint16_t>(bucket);
+                ++counts[bucket];
+            }
+        });
+    });
+
+    // bucket-major exclusive prefix sum over the slice histograms
+    std::vector<std::ptrdiff_t> bucket_begin(buckets + 1);
+    auto sum = std::ptrdiff_t(0);
+    for (std::size_t b = 0; b < buckets; ++b)
+    {
+        bucket_begin[b] = sum;
+        for (std::size_t s = 0; s < slices; ++s)
+        {
+            const auto count = offsets[s * buckets + b];
+            offsets[s * buckets + b] = sum;
+            sum += count;
+        }
+    }
+    bucket_begin[buckets] = sum;
+
+    // node n owns the buckets starting below its even share of the output
+    std::vector<std::size_t> node_bucket(nodes + 1, buckets);
+    node_bucket[0] = 0;
+    for (std::size_t node = 1, b = 0; node < nodes; ++node)
+    {
+        while (b < buckets && bucket_begin[b] < static_cast<std::ptrdiff_t>(size * node / nodes))
+            ++b;
+        node_bucket[node] = b;
+    }
+
+    // allocated here but first touched by the owning node's workers
+    std::vector<std::unique_ptr<detail::uninitialized_buffer<value_type>>> local(nodes);
+    for (std::size_t node = 0; node < nodes; ++node)
+    {
+        const auto count = bucket_begin[node_bucket[node + 1]] - bucket_begin[node_bucket[node]];
+        local[node] = std::make_unique<detail::uninitialized_buffer<value_type>>(count);
+    }
+
+    // gather: node n pulls its buckets out of every slice
+    pools.run(1, [&](std::size_t node, std::size_t) {
+        const auto lo = node_bucket[node];
+        const auto hi = node_bucket[node + 1];
+        const auto base = bucket_begin[lo];
+        auto buffer = local[node]->data();
+
+        parallel::for_each_index(pools.pool(node), slices, [&](std::size_t s) {
+            auto positions = offsets.begin() + s * buckets;
+            for (auto j = slice_begin(s); j < slice_begin(s + 1); ++j)
+            {
+                const auto bucket = bucket_of[j];
+                if (bucket >= lo && bucket < hi)
+                    ::new (static_cast<void*>(buffer + (positions[bucket]++ - base))) value_type(std::move(first[j]));
+            }
+        });
+    });
+
+    // sort the buckets in place on their node, then move them back
+    pools.run(1, [&](std::size_t node, std::size_t) {
+        auto& pool = pools.pool(node);
+        const auto base = bucket_begin[node_bucket[node]];
+        const auto count = bucket_begin[node_bucket[node + 1]] - base;
+        auto buffer = local[node]->data();
+
+        {
+            parallel::task_group tasks(pool);
+            const parallel::cutoff_policy policy;
+            for (auto b = node_bucket[node]; b < node_bucket[node + 1]; ++b)
+            {
+                if (tree.is_equal_bucket(b))
+                    continue;
+
+                const auto bucket_first = buffer + (bucket_begin[b] - base);
+                const auto bucket_last = buffer + (bucket_begin[b + 1] - base);
+                tasks.run([bucket_first, bucket_last, &tasks, &policy, cmp]() {
+                    detail::pool_quicksort_task(bucket_first, bucket_last, tasks, policy, tasks.pool().size(), pivot::random<value_type*>, cmp, partition::two_way(), 0);
+                });
+            }
+            tasks.wait();
+        }
+
+        const auto chunks = pool.size();
+        parallel::for_each_index(pool, chunks, [&](std::size_t i) {
+            const auto begin = count * static_cast<std::ptrdiff_t>(i) / static_cast<std::ptrdiff_t>(chunks);
+            const auto end = count * static_cast<std::ptrdiff_t>(i + 1) / static_cast<std::ptrdiff_t>(chunks);
+            std::move(buffer + begin, buffer + end, first + (base + begin));
+            std::destroy(buffer + begin, buffer + end);
+        });
+    });
+}
+
+template<typename RandomIt, typename Cmp = std::less<>>
+void numa_samplesort(RandomIt first, RandomIt last, Cmp cmp = Cmp{})
+{
+    numa_samplesort(first, last, numa::default_node_pools(), cmp);
+}
+
+namespace detail
+{
+
+struct identity
+{
+    template<typename T>
+    constexpr T&& operator()(T&& t) const noexcept
+    {
+        return std::forward<T>(t);
+    }
+};
+
+// Maps a key onto an unsigned integer with the same ordering: signed
+// integers get their sign bit flipped, IEEE floats additionally have all
+// other bits inverted when negative (NaNs sort to the ends).
+template<typename Key>
+auto radix_bits(Key key)
+{
+    static_assert(std::is_arithmetic<Key>::value && !std::is_same<Key, bool>::value,
+                  "radix sort keys must be integers or floating point numbers");
+
+    if constexpr (std::is_floating_point<Key>::value)
+    {
+        using bits_type = std::conditional_t<sizeof(Key) == 4, std::uint32_t, std::uint64_t>;
+        static_assert(sizeof(Key) == sizeof(bits_type), "unsupported floating point type");
+
+        bits_type bits;
+        std::memcpy(&bits, &key, sizeof(bits));
+        const auto sign = bits_type(1) << (8 * sizeof(bits) - 1);
+        return (bits & sign) ? bits_type(~bits) : bits_type(bits ^ sign);
+    }
+    else
+    {
+        using bits_type = std::make_unsigned_t<Key>;
+        auto bits = static_cast<bits_type>(key);
+        if (std::is_signed<Key>::value)
+            bits ^= bits_type(1) << (8 * sizeof(bits) - 1);
+        return bits;
+    }
+}
+
+template<typename T, typename Proj>
+using radix_bits_t = decltype(radix_bits(std::invoke(std::declval<Proj&>(), std::declval<const T&>())));
+
+constexpr std::size_t radix = 256;
+constexpr std::ptrdiff_t radix_sort_threshold = 64;
+
+template<typename BiIt, typename Proj>
+void key_insertion_sort(BiIt first, BiIt last, Proj& proj)
+{
+    insertion_sort(first, last, [&proj](const auto& a, const auto& b) {
+        return radix_bits(std::invoke(proj, a)) < radix_bits(std::invoke(proj, b));
+    });
+}
+
+// Stable LSD passes over the lowest digits bytes of the key, ping-ponging
+// between the two ranges. Digits on which all keys agree are skipped.
+// Returns true if the sorted sequence ended up in dst.
+template<typename SrcIt, typename DstIt, typename Proj>
+bool lsd_radix_passes(SrcIt src, DstIt dst, std::ptrdiff_t size, Proj& proj, int digits)
+{
+    using value_type = typename std::iterator_traits<SrcIt>::value_type;
+    using bits_type = radix_bits_t<value_type, Proj>;
+
+    std::array<std::array<std::ptrdiff_t, radix>, sizeof(bits_type)> counts{};
+    for (std::ptrdiff_t i = 0; i < size; ++i)
+    {
+        const auto bits = radix_bits(std::invoke(proj, src[i]));
+        for (int d = 0; d < digits; ++d)
+            ++counts[d][(bits >> (8 * d)) & (radix - 1)];
+    }
+
+    bool in_dst = false;
+    for (int d = 0; d < digits; ++d)
+    {
+        auto& offsets = counts[d];
+        const auto first_digit = (radix_bits(std::invoke(proj, src[0])) >> (8 * d)) & (radix - 1);
+        if (offsets[first_digit] == size)
+            continue;
+
+        auto sum = std::ptrdiff_t(0);
+        for (auto& offset : offsets)
+            sum += std::exchange(offset, sum);
+
+        auto scatter = [&offsets, &proj, size, d](auto from, auto to) {
+            for (std::ptrdiff_t i = 0; i < size; ++i)
+            {
+                const auto digit = (radix_bits(std::invoke(proj, from[i])) >> (8 * d)) & (radix - 1);
+                to[offsets[digit]++] = std::move(from[i]);
+            }
+        };
+
+        if (in_dst)
+            scatter(dst, src);
+        else
+            scatter(src, dst);
+        in_dst = !in_dst;
+    }
+
+    return in_dst;
+}
+
+} // namespace detail
+
+// LSD radix sort for integer and floating point keys, or for records through
+// a projection returning one. Out of place: the scratch buffer is grown to
+// the input size if needed and can be kept by the caller across calls.
+// Stable.
+template<typename RandomIt, typename Proj = detail::identity>
+void radix_sort(RandomIt first, RandomIt last, std::vector<typename std::iterator_traits<RandomIt>::value_type>& scratch, Proj proj = Proj{})
+{
+    const auto size = last - first;
+    if (size < detail::radix_sort_threshold)
+    {
+        detail::key_insertion_sort(first, last, proj);
+        return;
+    }
+
+    using bits_type = detail::radix_bits_t<typename std::iterator_traits<RandomIt>::value_type, Proj>;
+
+    if (scratch.size() < static_cast<std::size_t>(size))
+        scratch.resize(size);
+
+    if (detail::lsd_radix_passes(first, scratch.begin(), size, proj, sizeof(bits_type)))
+        std::move(scratch.begin(), scratch.begin() + size, first);
+}
+
+template<typename RandomIt, typename Proj = detail::identity>
+void radix_sort(RandomIt first, RandomIt last, Proj proj = Proj{})
+{
+    std::vector<typename std::iterator_traits<RandomIt>::value_type> scratch;
+    radix_sort(first, last, scratch, proj);
+}
+
+// Parallel MSD radix sort on the thread pool: the most significant digit on
+// which the keys differ is used to scatter the input into up to 256 buckets
+// in parallel, and every bucket then gets LSD passes over the digits below
+// as its own task. Like radix_sort, the scratch buffer is grown to the
+// input size if needed and can be kept by the caller across calls.
+template<typename RandomIt, typename Proj = detail::identity>
+void parallel_radix_sort(RandomIt first, RandomIt last, std::vector<typename std::iterator_traits<RandomIt>::value_type>& scratch, parallel::thread_pool& pool, Proj proj = Proj{})
+{
+    using value_type = typename std::iterator_traits<RandomIt>::value_type;
+    using bits_type = detail::radix_bits_t<value_type, Proj>;
+    using histogram = std::array<std::array<std::ptrdiff_t, detail::radix>, sizeof(bits_type)>;
+
+    const auto size = last - first;
+    if (pool.size() < 2 || size < detail::samplesort_threshold)
+    {
+        radix_sort(first, last, scratch, proj);
+        return;
+    }
+
+    const auto chunks = static_cast<std::ptrdiff_t>(pool.size());
+    auto chunk_begin = [size, chunks](std::ptrdiff_t i) { return size * i / chunks; };
+
+    std::vector<histogram> counts(chunks);
+    parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+        auto& count = counts[i];
+        for (auto j = chunk_begin(i); j < chunk_begin(i + 1); ++j)
+        {
+            const auto bits = detail::radix_bits(std::invoke(proj, first[j]));
+            for (std::size_t d = 0; d < sizeof(bits_type); ++d)
+                ++count[d][(bits >> (8 * d)) & (detail::radix - 1)];
+        }
+    });
+
+    // highest digit that actually separates keys
+    int digit = sizeof(bits_type) - 1;
+    const auto top_of = [&](int d) {
+        return (detail::radix_bits(std::invoke(proj, first[0])) >> (8 * d)) & (detail::radix - 1);
+    };
+    auto total_of = [&](int d, std::size_t value) {
+        auto total = std::ptrdiff_t(0);
+        for (const auto& count : counts)
+            total += count[d][value];
+        return total;
+    };
+    while (digit >= 0 && total_of(digit, top_of(digit)) == size)
+        --digit;
+    if (digit < 0)
+        return;
+
+    std::vector<std::ptrdiff_t> bucket_begin(detail::radix + 1);
+    auto sum = std::ptrdiff_t(0);
+    for (std::size_t b = 0; b < detail::radix; ++b)
+    {
+        bucket_begin[b] = sum;
+        for (auto& count : counts)
+            sum += std::exchange(count[digit][b], sum);
+    }
+    bucket_begin[detail::radix] = sum;
+
+    if (scratch.size() < static_cast<std::size_t>(size))
+        scratch.resize(size);
+    parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+        auto& positions = counts[i][digit];
+        for (auto j = chunk_begin(i); j < chunk_begin(i + 1); ++j)
+        {
+            const auto d = (detail::radix_bits(std::invoke(proj, first[j])) >> (8 * digit)) & (detail::radix - 1);
+            scratch[positions[d]++] = std::move(first[j]);
+        }
+    });
+
+    parallel::task_group tasks(pool);
+    for (std::size_t b = 0; b < detail::radix; ++b)
+    {
+        const auto begin = bucket_begin[b];
+        const auto bucket_size = bucket_begin[b + 1] - begin;
+        if (bucket_size == 0)
+            continue;
+
+        tasks.run([&scratch, first, begin, bucket_size, digit, proj]() mutable {
+            auto from = scratch.begin() + begin;
+            auto to = first + begin;
+
+            if (bucket_size < detail::radix_sort_threshold)
+            {
+                detail::key_insertion_sort(from, from + bucket_size, proj);
+                std::move(from, from + bucket_size, to);
+            }
+            else if (!detail::lsd_radix_passes(from, to, bucket_size, proj, digit))
+            {
+                std::move(from, from + bucket_size, to);
+            }
+        });
+    }
+    tasks.wait();
+}
+
+template<typename RandomIt, typename Proj = detail::identity>
+void parallel_radix_sort(RandomIt first, RandomIt last, parallel::thread_pool& pool, Proj proj = Proj{})
+{
+    std::vector<typename std::iterator_traits<RandomIt>::value_type> scratch;
+    parallel_radix_sort(first, last, scratch, pool, proj);
+}
+
+template<typename RandomIt, typename Proj = detail::identity>
+void parallel_radix_sort(RandomIt first, RandomIt last, Proj proj = Proj{})
+{
+    parallel_radix_sort(first, last, parallel::default_pool(), proj);
+}
+
+// Sorts by std::invoke(proj, element) instead of the element itself, like the
+// projections of std::ranges::sort.
+template<typename BiIt,
+         typename Proj,
+         typename Cmp = std::less<>,
+         typename = std::enable_if_t<detail::is_projection<Proj, BiIt>>>
+void sequential_quicksort(BiIt first, BiIt last, Proj proj, Cmp cmp = Cmp{})
+{
+    sequential_quicksort(first, last, pivot::random<BiIt>, detail::projected_compare<Cmp, Proj>{cmp, proj});
+}
+
+template<typename BiIt,
+         typename Proj,
+         typename Cmp = std::less<>,
+         typename = std::enable_if_t<detail::is_projection<Proj, BiIt>>>
+void pool_parallel_quicksort(BiIt first, BiIt last, parallel::thread_pool& pool, Proj proj, Cmp cmp = Cmp{})
+{
+    pool_parallel_quicksort(first, last, pool, pivot::random<BiIt>, detail::projected_compare<Cmp, Proj>{cmp, proj});
+}
+
+template<typename BiIt,
+         typename Proj,
+         typename Cmp = std::less<>,
+         typename = std::enable_if_t<detail::is_projection<Proj, BiIt>>>
+void pool_parallel_quicksort(BiIt first, BiIt last, Proj proj, Cmp cmp = Cmp{})
+{
+    pool_parallel_quicksort(first, last, parallel::default_pool(), proj, cmp);
+}
+
+// Execution policy tags for the quicksort() front-end, with the meaning of
+// the std::execution ones, which are accepted as well: seq sorts on the
+// calling thread, par and par_unseq on the default pool. The SIMD partition
+// kernels are used under every policy whenever range and comparator allow.
+namespace execution
+{
+
+struct sequenced_policy {};
+struct parallel_policy {};
+struct parallel_unsequenced_policy {};
+
+inline constexpr sequenced_policy seq{};
+inline constexpr parallel_policy par{};
+inline constexpr parallel_unsequenced_policy par_unseq{};
+
+} // namespace execution
+
+namespace detail
+{
+
+template<typename Policy>
+constexpr bool is_parallel_policy = std::is_same<Policy, execution::parallel_policy>::value
+    || std::is_same<Policy, execution::parallel_unsequenced_policy>::value
+#ifdef __cpp_lib_execution
+    || std::is_same<Policy, std::execution::parallel_policy>::value
+    || std::is_same<Policy, std::execution::parallel_unsequenced_policy>::value
+#endif
+    ;
+
+template<typename Policy>
+constexpr bool is_execution_policy = is_parallel_policy<Policy>
+    || std::is_same<Policy, execution::sequenced_policy>::value
+#ifdef __cpp_lib_execution
+    || std::is_execution_policy<Policy>::value
+#endif
+    ;
+
+template<typename It>
+using iter_reference_t = typename std::iterator_traits<It>::reference;
+
+// Whether cmp orders the projections of the elements of It.
+template<typename Cmp, typename Proj, typename It, typename = void>
+constexpr bool is_comparator_for = false;
+
+template<typename Cmp, typename Proj, typename It>
+constexpr bool is_comparator_for<Cmp, Proj, It, std::void_t<std::invoke_result_t<Proj&, iter_reference_t<It>>>> =
+    std::is_invocable_r<bool, Cmp&, std::invoke_result_t<Proj&, iter_reference_t<It>>, std::invoke_result_t<Proj&, iter_reference_t<It>>>::value;
+
+// Comparator the engines see once a projection is folded in.
+template<typename Cmp, typename Proj>
+using front_end_compare_t = std::conditional_t<std::is_same<Proj, identity>::value, Cmp, projected_compare<Cmp, Proj>>;
+
+// Whether pivot_func picks a pivot in [first, last), as choose_pivot calls it.
+template<typename Pivot_func, typename It, typename Cmp>
+constexpr bool is_pivot_for = std::is_invocable_r<It, Pivot_func&, It, It, Cmp&>::value
+    || std::is_invocable_r<It, Pivot_func&, It, It>::value;
+
+template<typename Partition_func, typename It, typename Cmp>
+constexpr bool is_partition_for = std::is_invocable_r<partition::result<It>, const Partition_func&, It, It, Cmp>::value;
+
+template<typename It, typename Cmp, typename Proj, typename Pivot_func, typename Partition_func>
+constexpr bool is_front_end_call = is_comparator_for<Cmp, Proj, It>
+    && is_pivot_for<Pivot_func, It, front_end_compare_t<Cmp, Proj>>
+    && is_partition_for<Partition_func, It, front_end_compare_t<Cmp, Proj>>;
+
+} // namespace detail
+
+// std::sort(policy, first, last, cmp) shaped entry point, plus a projection
+// like std::ranges::sort has, and the pivot policy and partition scheme the
+// engines take. Sequenced policies run sequential_quicksort, parallel ones
+// pool_parallel_quicksort. A comparator, pivot or partition scheme that
+// does not fit the iterator removes the overload, so the mistake is
+// reported at the call.
+template<typename Policy,
+         typename RandomIt,
+         typename Cmp = std::less<>,
+         typename Proj = detail::identity,
+         typename Pivot_func = decltype(pivot::random<RandomIt>),
+         typename Partition_func = partition::two_way,
+         typename = std::enable_if_t<detail::is_execution_policy<std::decay_t<Policy>>
+                                     && detail::is_front_end_call<RandomIt, Cmp, Proj, Pivot_func, Partition_func>>>
+void quicksort(Policy&& policy, RandomIt first, RandomIt last, Cmp cmp = Cmp{}, Proj proj = Proj{}, Pivot_func pivot_func = pivot::random, Partition_func partition_func = Partition_func{})
+{
+    static_assert(std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<RandomIt>::iterator_category>::value,
+                  "quicksort(policy, ...) needs random access iterators");
+
+    if constexpr (!std::is_same<Proj, detail::identity>::value)
+        quicksort(policy, first, last, detail::projected_compare<Cmp, Proj>{cmp, proj}, detail::identity(), pivot_func, partition_func);
+    else if constexpr (detail::is_parallel_policy<std::decay_t<Policy>>)
+        pool_parallel_quicksort(first, last, pivot_func, cmp, partition_func);
+    else
+        sequential_quicksort(first, last, pivot_func, cmp, partition_func);
+}
+
+#if defined(__cpp_lib_ranges) && defined(__cpp_lib_concepts)
+// std::ranges::sort shaped front-end. The constraints are those of
+// std::ranges::sort, so a comparator or projection of the wrong type is
+// reported at the call instead of deep inside the engines.
+namespace ranges
+{
+
+namespace detail
+{
+
+// Plain std::less keeps the SIMD kernels eligible.
+template<typename Cmp, typename Proj>
+auto classic_compare(Cmp cmp, Proj proj)
+{
+    if constexpr (std::is_same<Proj, std::identity>::value && std::is_same<Cmp, std::ranges::less>::value)
+        return std::less<>();
+    else if constexpr (std::is_same<Proj, std::identity>::value)
+        return cmp;
+    else
+        return ::detail::projected_compare<Cmp, Proj>{cmp, proj};
+}
+
+template<typename Cmp, typename Proj>
+using classic_compare_t = decltype(classic_compare(std::declval<Cmp>(), std::declval<Proj>()));
+
+} // namespace detail
+
+// A pivot policy for iterators I under comparator C: called as
+// pivot_func(first, last, cmp) or pivot_func(first, last), returning an I.
+template<typename Pivot_func, typename I, typename C>
+concept pivot_policy = std::is_invocable_r_v<I, Pivot_func&, I, I, C&> || std::is_invocable_r_v<I, Pivot_func&, I, I>;
+
+// A partition scheme such as partition::two_way for iterators I.
+template<typename Partition_func, typename I, typename C>
+concept partition_scheme = std::is_invocable_r_v<::partition::result<I>, const Partition_func&, I, I, C>;
+
+template<typename Policy,
+         std::random_access_iterator I,
+         std::sentinel_for<I> S,
+         typename Cmp = std::ranges::less,
+         typename Proj = std::identity,
+         pivot_policy<I, detail::classic_compare_t<Cmp, Proj>> Pivot_func = decltype(pivot::random<I>),
+         partition_scheme<I, detail::classic_compare_t<Cmp, Proj>> Partition_func = ::partition::two_way>
+    requires ::detail::is_execution_policy<std::remove_cvref_t<Policy>> && std::sortable<I, Cmp, Proj>
+I quicksort(Policy&& policy, I first, S last, Cmp cmp = {}, Proj proj = {}, Pivot_func pivot_func = pivot::random, Partition_func partition_func = {})
+{
+    const auto end = std::ranges::next(first, last);
+    ::quicksort(policy, first, end, detail::classic_compare(cmp, proj), ::detail::identity(), pivot_func, partition_func);
+    return end;
+}
+
+template<typename Policy,
+         std::ranges::random_access_range R,
+         typename Cmp = std::ranges::less,
+         typename Proj = std::identity,
+         pivot_policy<std::ranges::iterator_t<R>, detail::classic_compare_t<Cmp, Proj>> Pivot_func = decltype(pivot::random<std::ranges::iterator_t<R>>),
+         partition_scheme<std::ranges::iterator_t<R>, detail::classic_compare_t<Cmp, Proj>> Partition_func = ::partition::two_way>
+    requires ::detail::is_execution_policy<std::remove_cvref_t<Policy>> && std::sortable<std::ranges::iterator_t<R>, Cmp, Proj>
+std::ranges::borrowed_iterator_t<R> quicksort(Policy&& policy, R&& r, Cmp cmp = {}, Proj proj = {}, Pivot_func pivot_func = pivot::random, Partition_func partition_func = {})
+{
+    return ranges::quicksort(policy, std::ranges::begin(r), std::ranges::end(r), cmp, proj, pivot_func, partition_func);
+}
+
+template<std::random_access_iterator I,
+         std::sentinel_for<I> S,
+         typename Cmp = std::ranges::less,
+         typename Proj = std::identity,
+         pivot_policy<I, detail::classic_compare_t<Cmp, Proj>> Pivot_func = decltype(pivot::random<I>),
+         partition_scheme<I, detail::classic_compare_t<Cmp, Proj>> Partition_func = ::partition::two_way>
+    requires std::sortable<I, Cmp, Proj>
+I quicksort(I first, S last, Cmp cmp = {}, Proj proj = {}, Pivot_func pivot_func = pivot::random, Partition_func partition_func = {})
+{
+    return ranges::quicksort(execution::seq, first, last, cmp, proj, pivot_func, partition_func);
+}
+
+template<std::ranges::random_access_range R,
+         typename Cmp = std::ranges::less,
+         typename Proj = std::identity,
+         pivot_policy<std::ranges::iterator_t<R>, detail::classic_compare_t<Cmp, Proj>> Pivot_func = decltype(pivot::random<std::ranges::iterator_t<R>>),
+         partition_scheme<std::ranges::iterator_t<R>, detail::classic_compare_t<Cmp, Proj>> Partition_func = ::partition::two_way>
+    requires std::sortable<std::ranges::iterator_t<R>, Cmp, Proj>
+std::ranges::borrowed_iterator_t<R> quicksort(R&& r, Cmp cmp = {}, Proj proj = {}, Pivot_func pivot_func = pivot::random, Partition_func partition_func = {})
+{
+    return ranges::quicksort(execution::seq, std::ranges::begin(r), std::ranges::end(r), cmp, proj, pivot_func, partition_func);
+}
+
+} // namespace ranges
+#endif
+
+namespace detail
+{
+
+template<typename RandomIt, typename Proj>
+using cached_key_t = std::pair<std::decay_t<std::invoke_result_t<Proj&, typename std::iterator_traits<RandomIt>::reference>>, std::size_t>;
+
+template<typename RandomIt, typename Proj>
+std::vector<cached_key_t<RandomIt, Proj>> extract_keys(RandomIt first, std::size_t begin, std::size_t end, Proj& proj)
+{
+    std::vector<cached_key_t<RandomIt, Proj>> keys;
+    keys.reserve(end - begin);
+    for (auto i = begin; i < end; ++i)
+        keys.emplace_back(std::invoke(proj, first[i]), i);
+    return keys;
+}
+
+// Moves the records into the order given by keys[i].second (the source
+// index of the record that belongs at i), following each permutation cycle
+// once. Indices are overwritten to mark records already in place.
+template<typename RandomIt, typename Key>
+void apply_permutation(RandomIt first, std::vector<std::pair<Key, std::size_t>>& keys)
+{
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        if (keys[i].second == i)
+            continue;
+
+        auto value = std::move(first[i]);
+        auto hole = i;
+        while (keys[hole].second != i)
+        {
+            const auto source = keys[hole].second;
+            first[hole] = std::move(first[source]);
+            keys[hole].second = hole;
+            hole = source;
+        }
+        first[hole] = std::move(value);
+        keys[hole].second = hole;
+    }
+}
+
+// Parallel flavour of apply_permutation that leaves keys untouched, so the
+// same permutation can be applied to several ranges: position j receives
+// the element at keys[j].second, gathered through a buffer in chunks.
+template<typename RandomIt, typename Key>
+void parallel_apply_permutation(RandomIt first, const std::vector<std::pair<Key, std::size_t>>& keys, parallel::thread_pool& pool)
+{
+    using value_type = typename std::iterator_traits<RandomIt>::value_type;
+
+    const auto size = keys.size();
+    const auto chunks = std::max<std::size_t>(1, std::min(pool.size(), size / (1 << 14)));
+    auto chunk_begin = [size, chunks](std::size_t i) { return size * i / chunks; };
+
+    uninitialized_buffer<value_type> buffer(size);
+    parallel::for_each_index(pool, chunks, [&](std::size_t i) {
+        for (auto j = chunk_begin(i); j < chunk_begin(i + 1); ++j)
+            ::new (static_cast<void*>(buffer.data() + j)) value_type(std::move(first[keys[j].second]));
+    });
+    parallel::for_each_index(pool, chunks, [&](std::size_t i) {
+        std::move(buffer.data() + chunk_begin(i), buffer.data() + chunk_begin(i + 1), first + chunk_begin(i));
+        std::destroy(buffer.data() + chunk_begin(i), buffer.data() + chunk_begin(i + 1));
+    });
+}
+
+} // namespace detail
+
+// Decorate-sort-undecorate: the keys are extracted once into a compact
+// (key, index) array, which is what gets partitioned, and the records are
+// moved into place in one final pass. Pays off for large records with
+// small keys, where moving the records around is the dominant cost.
+template<typename RandomIt,
+         typename Proj,
+         typename Cmp = std::less<>>
+void cached_key_quicksort(RandomIt first, RandomIt last, Proj proj, Cmp cmp = Cmp{})
+{
+    auto keys = detail::extract_keys(first, 0, last - first, proj);
+
+    sequential_quicksort(keys.begin(), keys.end(), [](const auto& key) -> const auto& { return key.first; }, cmp);
+    detail::apply_permutation(first, keys);
+}
+
+// Parallel flavour: keys are extracted and the records gathered through a
+// buffer by all workers, the key array is sorted by pool_parallel_quicksort.
+template<typename RandomIt,
+         typename Proj,
+         typename Cmp = std::less<>>
+void cached_key_quicksort(RandomIt first, RandomIt last, parallel::thread_pool& pool, Proj proj, Cmp cmp = Cmp{})
+{
+    const auto size = static_cast<std::size_t>(last - first);
+    const auto chunks = std::max<std::size_t>(1, std::min(pool.size(), size / (1 << 14)));
+    auto chunk_begin = [size, chunks](std::size_t i) { return size * i / chunks; };
+
+    std::vector<detail::cached_key_t<RandomIt, Proj>> keys(size);
+    parallel::for_each_index(pool, chunks, [&](std::size_t i) {
+        for (auto j = chunk_begin(i); j < chunk_begin(i + 1); ++j)
+            keys[j] = {std::invoke(proj, first[j]), j};
+    });
+
+    pool_parallel_quicksort(keys.begin(), keys.end(), pool, [](const auto& key) -> const auto& { return key.first; }, cmp);
+    detail::parallel_apply_permutation(first, keys, pool);
+}
+
+// Sorts a key column and reorders any number of payload columns the same
+// way, for structure-of-arrays data that would otherwise be zipped into
+// records first. The keys are moved into a (key, index) array and sorted by
+// pool_parallel_quicksort; the sorted keys are moved back and the index
+// permutation is applied to every payload column in turn, each in parallel.
+// Ties between keys leave the payloads in unspecified order.
+template<typename KeyIt, typename Cmp, typename... ValueIts>
+void sort_by_key(parallel::thread_pool& pool, Cmp cmp, KeyIt keys_first, KeyIt keys_last, ValueIts... values_first)
+{
+    using key_type = typename std::iterator_traits<KeyIt>::value_type;
+
+    const auto size = static_cast<std::size_t>(keys_last - keys_first);
+    const auto chunks = std::max<std::size_t>(1, std::min(pool.size(), size / (1 << 14)));
+    auto chunk_begin = [size, chunks](std::size_t i) { return size * i / chunks; };
+
+    std::vector<std::pair<key_type, std::size_t>> keys(size);
+    parallel::for_each_index(pool, chunks, [&](std::size_t i) {
+        for (auto j = chunk_begin(i); j < chunk_begin(i + 1); ++j)
+            keys[j] = {std::move(keys_first[j]), j};
+    });
+
+    pool_parallel_quicksort(keys.begin(), keys.end(), pool, [](const auto& key) -> const auto& { return key.first; }, cmp);
+
+    parallel::for_each_index(pool, chunks, [&](std::size_t i) {
+        for (auto j = chunk_begin(i); j < chunk_begin(i + 1); ++j)
+            keys_first[j] = std::move(keys[j].first);
+    });
+    (detail::parallel_apply_permutation(values_first, keys, pool), ...);
+}
+
+template<typename KeyIt, typename... ValueIts>
+void sort_by_key(KeyIt keys_first, KeyIt keys_last, ValueIts... values_first)
+{
+    sort_by_key(parallel::default_pool(), std::less<>(), keys_first, keys_last, values_first...);
+}
+
+namespace detail
+{
+
+// Tournament tree over k sorted sources that stores the loser of every
+// match, so replacing the winner replays a single leaf-to-root path of
+// log2(k) comparisons. Ties go to the lower source index, which makes the
+// merge stable with respect to the order of the sources.
+template<typename It, typename Cmp>
+class loser_tree
+{
+public:
+    loser_tree(std::vector<std::pair<It, It>> sources, Cmp cmp)
+        : sources_(std::move(sources)), cmp_(cmp), leaves_(1)
+    {
+        while (leaves_ < sources_.size())
+            leaves_ *= 2;
+
+        // winners of the subtrees, only needed while building
+        std::vector<std::size_t> winners(2 * leaves_);
+        tree_.resize(leaves_);
+        for (std::size_t i = 0; i < leaves_; ++i)
+            winners[leaves_ + i] = i;
+        for (auto node = leaves_ - 1; node > 0; --node)
+        {
+            const auto a = winners[2 * node], b = winners[2 * node + 1];
+            winners[node] = beats(a, b) ? a : b;
+            tree_[node] = beats(a, b) ? b : a;
+        }
+        tree_[0] = winners[1];
+    }
+
+    // Source holding the smallest remaining element.
+    std::size_t top() const
+    {
+        return tree_[0];
+    }
+
+    It& cursor(std::size_t source)
+    {
+        return sources_[source].first;
+    }
+
+    // Advances the winning source and replays its matches.
+    void pop()
+    {
+        auto winner = tree_[0];
+        ++sources_[winner].first;
+        for (auto node = (winner + leaves_) / 2; node > 0; node /= 2)
+            if (beats(tree_[node], winner))
+                std::swap(tree_[node], winner);
+        tree_[0] = winner;
+    }
+
+private:
+    bool exhausted(std::size_t source) const
+    {
+        return source >= sources_.size() || sources_[source].first == sources_[source].second;
+    }
+
+    bool beats(std::size_t a, std::size_t b) const
+    {
+        if (exhausted(a))
+            return false;
+        if (exhausted(b))
+            return true;
+        if (cmp_(*sources_[b].first, *sources_[a].first))
+            return false;
+        return cmp_(*sources_[a].first, *sources_[b].first) || a < b;
+    }
+
+    std::vector<std::pair<It, It>> sources_;
+    Cmp cmp_;
+    std::size_t leaves_;
+    std::vector<std::size_t> tree_;
+};
+
+// Hands the first count elements of the merged sources to emit, in order,
+// as lvalues the caller may move from.
+template<typename It, typename Cmp, typename Emit>
+void multiway_merge(std::vector<std::pair<It, It>> sources, std::size_t count, Cmp cmp, Emit emit)
+{
+    if (sources.size() == 1)
+    {
+        for (auto it = sources[0].first; count-- > 0; ++it)
+            emit(*it);
+        return;
+    }
+
+    loser_tree<It, Cmp> tree(std::move(sources), cmp);
+    for (; count > 0; --count)
+    {
+        emit(*tree.cursor(tree.top()));
+        tree.pop();
+    }
+}
+
+// Co-ranking: positions splitting every source so that the prefixes hold
+// exactly the rank smallest elements of the stable merge. Selects in a
+// strict total order (value, source, position): the window with the most
+// candidates is halved around its middle element by binary searching every
+// other window, so O(k log n) rounds of k binary searches suffice.
+template<typename RandomIt, typename Cmp>
+std::vector<std::ptrdiff_t> co_rank(const std::vector<std::pair<RandomIt, RandomIt>>& sources, std::ptrdiff_t rank, Cmp& cmp)
+{
+    const auto k = sources.size();
+    std::vector<std::ptrdiff_t> lo(k, 0), hi(k), below(k);
+    for (std::size_t i = 0; i < k; ++i)
+        hi[i] = sources[i].second - sources[i].first;
+
+    while (rank > 0)
+    {
+        std::size_t widest = 0;
+        for (std::size_t i = 1; i < k; ++i)
+            if (hi[i] - lo[i] > hi[widest] - lo[widest])
+                widest = i;
+
+        const auto position = lo[widest] + (hi[widest] - lo[widest]) / 2;
+        const auto& value = sources[widest].first[position];
+
+        // candidates ordered before (value, widest, position) in each window
+        std::ptrdiff_t total = 0;
+        for (std::size_t i = 0; i < k; ++i)
+        {
+            const auto begin = sources[i].first + lo[i], end = sources[i].first + hi[i];
+            if (i < widest)
+                below[i] = std::upper_bound(begin, end, value, cmp) - begin;
+            else if (i > widest)
+                below[i] = std::lower_bound(begin, end, value, cmp) - begin;
+            else
+                below[i] = position - lo[i];
+            total += below[i];
+        }
+
+        if (rank < total)
+        {
+            for (std::size_t i = 0; i < k; ++i)
+                hi[i] = lo[i] + below[i];
+        }
+        else
+        {
+            // everything below the probe belongs to the prefix, and so
+            // does the probe itself unless the prefix is complete
+            for (std::size_t i = 0; i < k; ++i)
+                lo[i] += below[i];
+            rank -= total;
+            if (rank > 0)
+            {
+                ++lo[widest];
+                --rank;
+            }
+        }
+    }
+    return lo;
+}
+
+// Sources per output chunk and the output offset of each chunk.
+template<typename RandomIt, typename Cmp>
+std::vector<std::vector<std::pair<RandomIt, RandomIt>>> split_merge(const std::vector<std::pair<RandomIt, RandomIt>>& sources, std::ptrdiff_t total, std::size_t chunks, Cmp& cmp)
+{
+    std::vector<std::vector<std::ptrdiff_t>> splits;
+    for (std::size_t i = 0; i <= chunks; ++i)
+        splits.push_back(co_rank(sources, total * static_cast<std::ptrdiff_t>(i) / static_cast<std::ptrdiff_t>(chunks), cmp));
+
+    std::vector<std::vector<std::pair<RandomIt, RandomIt>>> result(chunks);
+    for (std::size_t i = 0; i < chunks; ++i)
+        for (std::size_t j = 0; j < sources.size(); ++j)
+            if (splits[i][j] < splits[i + 1][j])
+                result[i].emplace_back(sources[j].first + splits[i][j], sources[j].first + splits[i + 1][j]);
+    return result;
+}
+
+// Smallest share of the output a worker merges on its own.
+constexpr std::ptrdiff_t parallel_merge_min_chunk = 1 << 14;
+
+// Merges the sources into out + [0, total) on the pool, emit(out + i, value)
+// storing one element. Every worker co-ranks its slice of the output and
+// runs its own loser tree over the matching pieces of the sources.
+template<typename RandomIt, typename OutIt, typename Cmp, typename Emit>
+void parallel_multiway_merge(const std::vector<std::pair<RandomIt, RandomIt>>& sources, OutIt out, parallel::thread_pool& pool, Cmp cmp, Emit emit)
+{
+    std::ptrdiff_t total = 0;
+    for (const auto& source : sources)
+        total += source.second - source.first;
+
+    const auto chunks = std::max<std::size_t>(1, std::min<std::size_t>(pool.size(), total / parallel_merge_min_chunk));
+    const auto pieces = split_merge(sources, total, chunks, cmp);
+    parallel::for_each_index(pool, chunks, [&](std::size_t i) {
+        auto to = out + total * static_cast<std::ptrdiff_t>(i) / static_cast<std::ptrdiff_t>(chunks);
+        const auto count = static_cast<std::size_t>(total * static_cast<std::ptrdiff_t>(i + 1) / static_cast<std::ptrdiff_t>(chunks)
+                                                    - total * static_cast<std::ptrdiff_t>(i) / static_cast<std::ptrdiff_t>(chunks));
+        if (count > 0)
+            multiway_merge(pieces[i], count, cmp, [&emit, &to](auto& value) { emit(to++, value); });
+    });
+}
+
+} // namespace detail
+
+// Merges k sorted runs into out with a loser tree and returns the end of
+// the output. Equal elements keep the order of the runs they come from.
+template<typename InIt, typename OutIt, typename Cmp = std::less<>>
+OutIt kway_merge(const std::vector<std::pair<InIt, InIt>>& runs, OutIt out, Cmp cmp = Cmp{})
+{
+    std::size_t total = 0;
+    for (const auto& run : runs)
+        total += static_cast<std::size_t>(std::distance(run.first, run.second));
+
+    detail::multiway_merge(runs, total, cmp, [&out](const auto& value) { *out++ = value; });
+    return out;
+}
+
+// Parallel kway_merge: the output is cut into one slice per worker, and the
+// runs are split to match by co-ranking (a multiway merge path), so workers
+// never synchronize beyond the final join.
+template<typename RandomIt, typename OutIt, typename Cmp = std::less<>>
+OutIt parallel_kway_merge(const std::vector<std::pair<RandomIt, RandomIt>>& runs, OutIt out, parallel::thread_pool& pool, Cmp cmp = Cmp{})
+{
+    std::ptrdiff_t total = 0;
+    for (const auto& run : runs)
+        total += run.second - run.first;
+
+    detail::parallel_multiway_merge(runs, out, pool, cmp, [](OutIt to, const auto& value) { *to = value; });
+    return out + total;
+}
+
+template<typename RandomIt, typename OutIt, typename Cmp = std::less<>>
+OutIt parallel_kway_merge(const std::vector<std::pair<RandomIt, RandomIt>>& runs, OutIt out, Cmp cmp = Cmp{})
+{
+    return parallel_kway_merge(runs, out, parallel::default_pool(), cmp);
+}
+
+// Stable parallel sort: one run per worker is sorted with std::stable_sort,
+// then all runs are merged in a single parallel k-way pass through a buffer
+// and moved back.
+template<typename RandomIt, typename Cmp = std::less<>>
+void parallel_multiway_mergesort(RandomIt first, RandomIt last, parallel::thread_pool& pool, Cmp cmp = Cmp{})
+{
+    using value_type = typename std::iterator_traits<RandomIt>::value_type;
+
+    const auto size = last - first;
+    const auto chunks = std::max<std::ptrdiff_t>(1, std::min<std::ptrdiff_t>(pool.size(), size / detail::parallel_merge_min_chunk));
+    if (chunks == 1)
+    {
+        std::stable_sort(first, last, cmp);
+        return;
+    }
+
+    auto chunk_begin = [size, chunks](std::ptrdiff_t i) { return size * i / chunks; };
+    std::vector<std::pair<RandomIt, RandomIt>> runs;
+    for (std::ptrdiff_t i = 0; i < chunks; ++i)
+        runs.emplace_back(first + chunk_begin(i), first + chunk_begin(i + 1));
+
+    parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+        std::stable_sort(first + chunk_begin(i), first + chunk_begin(i + 1), cmp);
+    });
+
+    detail::uninitialized_buffer<value_type> buffer(size);
+    detail::parallel_multiway_merge(runs, buffer.data(), pool, cmp, [](value_type* to, value_type& value) {
+        ::new (static_cast<void*>(to)) value_type(std::move(value));
+    });
+
+    parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+        std::move(buffer.data() + chunk_begin(i), buffer.data() + chunk_begin(i + 1), first + chunk_begin(i));
+        std::destroy(buffer.data() + chunk_begin(i), buffer.data() + chunk_begin(i + 1));
+    });
+}
+
+template<typename RandomIt, typename Cmp = std::less<>>
+void parallel_multiway_mergesort(RandomIt first, RandomIt last, Cmp cmp = Cmp{})
+{
+    parallel_multiway_mergesort(first, last, parallel::default_pool(), cmp);
+}
+
+namespace detail
+{
+
+// Stable merge of two runs, moving the elements into out.
+template<typename InIt, typename OutIt, typename Cmp>
+OutIt move_merge(InIt a, InIt a_last, InIt b, InIt b_last, OutIt out, Cmp& cmp)
+{
+    while (a != a_last && b != b_last)
+        *out++ = cmp(*b, *a) ? std::move(*b++) : std::move(*a++);
+    out = std::move(a, a_last, out);
+    return std::move(b, b_last, out);
+}
+
+// Runs sorted by insertion sort before stable_merge_sort starts merging.
+constexpr std::ptrdiff_t stable_run_size = 32;
+
+// Merges neighbouring runs of width elements from src into dst.
+template<typename Src, typename Dst, typename Cmp>
+void merge_pass(Src src, Dst dst, std::ptrdiff_t size, std::ptrdiff_t width, Cmp& cmp)
+{
+    for (std::ptrdiff_t i = 0; i < size; i += 2 * width)
+    {
+        const auto middle = std::min(i + width, size), end = std::min(i + 2 * width, size);
+        move_merge(src + i, src + middle, src + middle, src + end, dst + i, cmp);
+    }
+}
+
+// Bottom-up merge sort bouncing between the range and buffer, which must
+// hold at least last - first constructed elements.
+template<typename RandomIt, typename BufferIt, typename Cmp>
+void stable_merge_sort(RandomIt first, RandomIt last, BufferIt buffer, Cmp& cmp)
+{
+    const auto size = last - first;
+    for (std::ptrdiff_t i = 0; i < size; i += stable_run_size)
+        insertion_sort(first + i, first + std::min(i + stable_run_size, size), cmp);
+
+    bool in_buffer = false;
+    for (auto width = stable_run_size; width < size; width *= 2, in_buffer = !in_buffer)
+    {
+        if (in_buffer)
+            merge_pass(buffer, first, size, width, cmp);
+        else
+            merge_pass(first, buffer, size, width, cmp);
+    }
+
+    if (in_buffer)
+        std::move(buffer, buffer + size, first);
+}
+
+} // namespace detail
+
+// Stable parallel sort: every worker merge sorts its own run, then one
+// parallel k-way merge combines the runs. All temporary storage is taken
+// from scratch, which is grown to last - first elements if needed and left
+// with unspecified contents; reusing it across calls avoids any O(n)
+// allocation. Allocator aware, so a std::pmr::vector backed by an arena
+// works as well. Requires default constructible elements.
+template<typename RandomIt, typename Alloc, typename Cmp = std::less<>>
+void parallel_stable_sort(RandomIt first, RandomIt last, std::vector<typename std::iterator_traits<RandomIt>::value_type, Alloc>& scratch, parallel::thread_pool& pool, Cmp cmp = Cmp{})
+{
+    const auto size = last - first;
+    if (static_cast<std::ptrdiff_t>(scratch.size()) < size)
+        scratch.resize(size);
+
+    const auto chunks = std::max<std::ptrdiff_t>(1, std::min<std::ptrdiff_t>(pool.size(), size / detail::parallel_merge_min_chunk));
+    auto chunk_begin = [size, chunks](std::ptrdiff_t i) { return size * i / chunks; };
+    parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+        detail::stable_merge_sort(first + chunk_begin(i), first + chunk_begin(i + 1), scratch.begin() + chunk_begin(i), cmp);
+    });
+    if (chunks == 1)
+        return;
+
+    std::vector<std::pair<RandomIt, RandomIt>> runs;
+    for (std::ptrdiff_t i = 0; i < chunks; ++i)
+        runs.emplace_back(first + chunk_begin(i), first + chunk_begin(i + 1));
+
+    detail::parallel_multiway_merge(runs, scratch.begin(), pool, cmp, [](auto to, auto& value) { *to = std::move(value); });
+    parallel::for_each_index(pool, chunks, [&](std::ptrdiff_t i) {
+        std::move(scratch.begin() + chunk_begin(i), scratch.begin() + chunk_begin(i + 1), first + chunk_begin(i));
+    });
+}
+
+template<typename RandomIt, typename Cmp = std::less<>>
+void parallel_stable_sort(RandomIt first, RandomIt last, parallel::thread_pool& pool, Cmp cmp = Cmp{})
+{
+    std::vector<typename std::iterator_traits<RandomIt>::value_type> scratch;
+    parallel_stable_sort(first, last, scratch, pool, cmp);
+}
+
+template<typename RandomIt, typename Cmp = std::less<>>
+void parallel_stable_sort(RandomIt first, RandomIt last, Cmp cmp = Cmp{})
+{
+    parallel_stable_sort(first, last, parallel::default_pool(), cmp);
+}
+
+#if QUICKSORT_HAS_MMAP
+// Sorting of files of fixed width records, e.g. structs written with
+// fwrite, that may be far larger than memory. POSIX only.
+namespace external
+{
+
+struct options
+{
+    // RAM a run may occupy while it is sorted; files up to this size are
+    // sorted in place in a single run
+    std::size_t memory_budget = std::size_t(1) << 30;
+    // size of each of the two output buffers of the merge
+    std::size_t write_buffer = std::size_t(1) << 24;
+    // merge output, renamed over the input at the end; defaults to the
+    // input path with ".sorting" appended
+    std::string temporary_path;
+};
+
+namespace detail
+{
+
+[[noreturn]] inline void throw_errno(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+// Shared read-write mapping of a whole file.
+class mapped_file
+{
+public:
+    explicit mapped_file(const std::string& path)
+        : fd_(::open(path.c_str(), O_RDWR))
+    {
+        if (fd_ < 0)
+            throw_errno("open " + path);
+
+        struct stat st;
+        if (::fstat(fd_, &st) != 0)
+        {
+            ::close(fd_);
+            throw_errno("fstat " + path);
+        }
+
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ > 0)
+        {
+            data_ = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            if (data_ == MAP_FAILED)
+            {
+                ::close(fd_);
+                throw_errno("mmap " + path);
+            }
+        }
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file()
+    {
+        if (data_)
+            ::munmap(data_, size_);
+        ::close(fd_);
+    }
+
+    char* data() const
+    {
+        return static_cast<char*>(data_);
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    void advise(std::size_t offset, std::size_t length, int advice) const
+    {
+        ::madvise(data() + offset, length, advice);
+    }
+
+    // Writes the dirty pages in [offset, offset + length) back to the file.
+    void sync(std::size_t offset, std::size_t length) const
+    {
+        if (length > 0 && ::msync(data() + offset, length, MS_SYNC) != 0)
+            throw_errno("msync");
+    }
+
+private:
+    int fd_;
+    void* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+// Appends to a file through two buffers: while the merge fills one, a
+// background thread writes the other with large sequential writes.
+class double_buffered_writer
+{
+public:
+    double_buffered_writer(const std::string& path, std::size_t buffer_size)
+        : fd_(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+          capacity_(std::max<std::size_t>(buffer_size, 4096))
+    {
+        if (fd_ < 0)
+            throw_errno("open " + path);
+
+        filling_.reserve(capacity_);
+        writing_.reserve(capacity_);
+        thread_ = std::thread([this]() { write_loop(); });
+    }
+
+    double_buffered_writer(const double_buffered_writer&) = delete;
+    double_buffered_writer& operator=(const double_buffered_writer&) = delete;
+
+    ~double_buffered_writer()
+    {
+        stop();
+        ::close(fd_);
+    }
+
+    void append(const char* data, std::size_t size)
+    {
+        if (filling_.size() + size > capacity_)
+            hand_over();
+        filling_.insert(filling_.end(), data, data + size);
+    }
+
+    // Writes what is left, waits for the writer and makes the file durable.
+    void finish()
+    {
+        hand_over();
+        stop();
+        if (error_)
+            std::rethrow_exception(error_);
+        if (::fsync(fd_) != 0)
+            throw_errno("fsync");
+    }
+
+private:
+    // Swaps the full buffer with the one the writer is done with.
+    void hand_over()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return !pending_; });
+        if (error_)
+            std::rethrow_exception(error_);
+
+        std::swap(filling_, writing_);
+        filling_.clear();
+        pending_ = true;
+        cv_.notify_all();
+    }
+
+    void stop()
+    {
+        if (!thread_.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    void write_loop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true)
+        {
+            cv_.wait(lock, [this]() { return pending_ || done_; });
+            if (!pending_)
+                return;
+
+            lock.unlock();
+            std::exception_ptr error;
+            try
+            {
+                write_all(writing_.data(), writing_.size());
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            lock.lock();
+
+            if (error)
+                error_ = error;
+            pending_ = false;
+            cv_.notify_all();
+        }
+    }
+
+    void write_all(const char* data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            const auto written = ::write(fd_, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw_errno("write");
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+    }
+
+    int fd_;
+    std::size_t capacity_;
+    std::vector<char> filling_;
+    std::vector<char> writing_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool pending_ = false;
+    bool done_ = false;
+    std::exception_ptr error_;
+};
+
+} // namespace detail
+
+// Sorts a file of T records in place through a shared mapping, with the
+// pooled quicksort: no read into a separate buffer, no copy back. The file
+// must fit into memory.
+template<typename T, typename Cmp = std::less<>>
+void sort_mapped_file(const std::string& path, parallel::thread_pool& pool, Cmp cmp = Cmp{})
+{
+    static_assert(std::is_trivially_copyable<T>::value, "records must be trivially copyable");
+
+    detail::mapped_file file(path);
+    if (file.size() % sizeof(T) != 0)
+        throw std::invalid_argument(path + " is not a whole number of records");
+
+    auto first = reinterpret_cast<T*>(file.data());
+    pool_parallel_quicksort(first, first + file.size() / sizeof(T), pool, pivot::random<T*>, cmp);
+    file.sync(0, file.size());
+}
+
+// Out-of-core sort of a file of T records. Files within the memory budget
+// are sorted in place by sort_mapped_file. Larger ones are cut into runs of
+// at most memory_budget bytes, which are sorted in place in the mapping,
+// one at a time, by the pooled quicksort and then dropped from memory. The
+// runs are k-way merged, read sequentially through the mapping and written
+// through a double buffered writer, into a temporary file that finally
+// replaces the input.
+template<typename T, typename Cmp = std::less<>>
+void external_sort(const std::string& path, parallel::thread_pool& pool, const options& opts = options{}, Cmp cmp = Cmp{})
+{
+    static_assert(std::is_trivially_copyable<T>::value, "records must be trivially copyable");
+
+    auto file = std::make_unique<detail::mapped_file>(path);
+    if (file->size() % sizeof(T) != 0)
+        throw std::invalid_argument(path + " is not a whole number of records");
+    if (file->size() <= opts.memory_budget)
+    {
+        file.reset();
+        sort_mapped_file<T>(path, pool, cmp);
+        return;
+    }
+
+    // runs start on page boundaries so each can be advised on its own
+    const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    const auto unit = page * sizeof(T); // a whole number of pages and records
+    const auto run_bytes = std::max(opts.memory_budget / unit, std::size_t(1)) * unit;
+
+    auto records = reinterpret_cast<T*>(file->data());
+    std::vector<std::pair<T*, T*>> runs;
+    for (std::size_t offset = 0; offset < file->size(); offset += run_bytes)
+    {
+        const auto length = std::min(run_bytes, file->size() - offset);
+        file->advise(offset, length, MADV_WILLNEED);
+
+        auto first = records + offset / sizeof(T);
+        pool_parallel_quicksort(first, first + length / sizeof(T), pool, pivot::random<T*>, cmp);
+        file->sync(offset, length);
+        file->advise(offset, length, MADV_DONTNEED);
+        runs.emplace_back(first, first + length / sizeof(T));
+    }
+
+    const auto temporary = opts.temporary_path.empty() ? path + ".sorting" : opts.temporary_path;
+    file->advise(0, file->size(), MADV_SEQUENTIAL);
+    {
+        detail::double_buffered_writer out(temporary, opts.write_buffer);
+        ::detail::multiway_merge(runs, file->size() / sizeof(T), cmp, [&out](const T& record) {
+            out.append(reinterpret_cast<const char*>(&record), sizeof(T));
+        });
+        out.finish();
+    }
+    file.reset();
+
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+        detail::throw_errno("rename " + temporary);
+}
+
+template<typename T, typename Cmp = std::less<>>
+void external_sort(const std::string& path, const options& opts = options{}, Cmp cmp = Cmp{})
+{
+    external_sort<T>(path, parallel::default_pool(), opts, cmp);
+}
+
+} // namespace external
+#endif
+
+namespace helpers
+{
+    template <class C>
+    void insert_random_ints(C& c)
+    {
+        std::random_device rd;
+        std::mt19937 g(rd());
+
+        std::iota(c.begin(), c.end(), 0);
+        std::shuffle(c.begin(), c.end(), g);
+    }
+} // namespace helpers
+
+// Benchmark harness, run with --bench [options]. Every engine is timed on
+// copies of the same input, the copy itself is not timed. Results go to
+// stdout as CSV (default) or JSON, one record per engine, element type,
+// distribution, size and cache state.
+namespace bench
+{
+
+// 64 byte payload record, sorted by key.
+struct record64
+{
+    std::uint64_t key;
+    char payload[56];
+
+    bool operator<(const record64& other) const
+    {
+        return key < other.key;
+    }
+};
+
+// Value of type T that sorts like rank.
+template<typename T>
+T make_value(std::uint64_t rank)
+{
+    if constexpr (std::is_same<T, std::string>::value)
+    {
+        const auto digits = std::to_string(rank);
+        return std::string(20 - digits.size(), '0') + digits;
+    }
+    else if constexpr (std::is_same<T, record64>::value)
+    {
+        record64 record{rank, {}};
+        std::memset(record.payload, static_cast<int>(rank & 0xff), sizeof(record.payload));
+        return record;
+    }
+    else
+    {
+        return static_cast<T>(rank);
+    }
+}
+
+// Distinct keys of the zipf distribution, at most.
+constexpr std::size_t zipf_keys = 1 << 20;
+
+// Ranks of the input of size n at position i, per distribution.
+class distribution
+{
+public:
+    distribution(const std::string& name, std::size_t n, std::uint64_t seed)
+        : name_(name), n_(n), rng_(seed)
+    {
+        if (name_ == "zipf")
+        {
+            // cumulative weights 1/1, 1/2, 1/3, ... of the keys
+            cdf_.resize(std::min(n_, zipf_keys));
+            double sum = 0;
+            for (std::size_t i = 0; i < cdf_.size(); ++i)
+                cdf_[i] = sum += 1.0 / static_cast<double>(i + 1);
+        }
+        else if (name_ != "random" && name_ != "sorted" && name_ != "reversed" && name_ != "few_unique"
+                 && name_ != "organ_pipe" && name_ != "median3_killer")
+        {
+            throw std::invalid_argument("unknown distribution " + name_);
+        }
+    }
+
+    std::uint64_t operator()(std::size_t i)
+    {
+        if (name_ == "random")
+            return rng_() >> 33;
+        if (name_ == "sorted")
+            return i;
+        if (name_ == "reversed")
+            return n_ - 1 - i;
+        if (name_ == "few_unique")
+            return rng_() % 16;
+        if (name_ == "organ_pipe")
+            return i < n_ / 2 ? i : n_ - 1 - i;
+        if (name_ == "zipf")
+        {
+            const auto u = static_cast<double>(rng_() >> 11) * 0x1p-53 * cdf_.back();
+            return static_cast<std::uint64_t>(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin());
+        }
+        return median3_killer(i);
+    }
+
+private:
+    // Musser's sequence that drives median-of-three quicksort quadratic,
+    // built on the largest prefix with an even half; the rest is ascending.
+    std::uint64_t median3_killer(std::size_t i) const
+    {
+        const auto k = n_ / 4 * 2;
+        const auto p = i + 1;
+        if (p > 2 * k)
+            return i;
+        if (p > k)
+            return 2 * (p - k) - 1;
+        return p % 2 ? p - 1 : k + p - 2;
+    }
+
+    std::string name_;
+    std::size_t n_;
+    ::detail::xorshift64star rng_;
+    std::vector<double> cdf_;
+};
+
+template<typename T>
+struct engine
+{
+    const char* name;
+    void (*sort)(std::vector<T>&);
+};
+
+template<typename T>
+std::vector<engine<T>> engines()
+{
+    using It = typename std::vector<T>::iterator;
+
+    std::vector<engine<T>> result = {
+        {"std_sort", [](std::vector<T>& v) { std::sort(v.begin(), v.end()); }},
+        {"sequential", [](std::vector<T>& v) { sequential_quicksort(v.begin(), v.end()); }},
+        {"sequential_block", [](std::vector<T>& v) { sequential_quicksort(v.begin(), v.end(), pivot::random<It>, std::less<>(), partition::block()); }},
+        {"sequential_three_way", [](std::vector<T>& v) { sequential_quicksort(v.begin(), v.end(), pivot::random<It>, std::less<>(), partition::three_way()); }},
+        {"introsort", [](std::vector<T>& v) { introsort_quicksort(v.begin(), v.end()); }},
+        {"dual_pivot", [](std::vector<T>& v) { dual_pivot_quicksort(v.begin(), v.end()); }},
+        {"triple_pivot", [](std::vector<T>& v) { triple_pivot_quicksort(v.begin(), v.end()); }},
+        {"naive_parallel", [](std::vector<T>& v) { naive_parallel_quicksort(v.begin(), v.end()); }},
+        {"pool_parallel", [](std::vector<T>& v) { pool_parallel_quicksort(v.begin(), v.end()); }},
+        {"parallel_samplesort", [](std::vector<T>& v) { parallel_samplesort(v.begin(), v.end()); }},
+        {"parallel_multiway_mergesort", [](std::vector<T>& v) { parallel_multiway_mergesort(v.begin(), v.end()); }},
+        {"parallel_stable_sort", [](std::vector<T>& v) { parallel_stable_sort(v.begin(), v.end()); }},
+    };
+
+    if constexpr (std::is_arithmetic<T>::value)
+    {
+        result.push_back({"radix_sort", [](std::vector<T>& v) { radix_sort(v.begin(), v.end()); }});
+        result.push_back({"parallel_radix_sort", [](std::vector<T>& v) { parallel_radix_sort(v.begin(), v.end()); }});
+    }
+    else if constexpr (std::is_same<T, record64>::value)
     {
-        const auto insertion = std::upper_bound(first, begin, *begin, cmp);
-        std::rotate(insertion, begin, std::next(begin));
+        result.push_back({"radix_sort", [](std::vector<T>& v) { radix_sort(v.begin(), v.end(), &record64::key); }});
+        result.push_back({"cached_key", [](std::vector<T>& v) { cached_key_quicksort(v.begin(), v.end(), &record64::key); }});
     }
+    return result;
 }
 
-template<typename It>
-void insertion_sort(It first, It last)
+struct options
 {
-    insertion_sort(first, last, std::less<>());
+    std::vector<std::size_t> sizes = {1000, 10000, 100000, 1000000, 10000000};
+    std::vector<std::string> distributions = {"random", "sorted", "reversed", "few_unique", "organ_pipe", "zipf", "median3_killer"};
+    std::vector<std::string> types = {"int32", "int64", "double", "string", "record64"};
+    std::vector<std::string> engines; // all if empty
+    std::size_t repeat = 0;           // scaled with the size if 0
+    bool json = false;
+};
+
+inline std::vector<std::string> split_list(const std::string& list)
+{
+    std::vector<std::string> result;
+    std::string::size_type begin = 0;
+    while (begin <= list.size())
+    {
+        const auto end = std::min(list.find(',', begin), list.size());
+        if (end > begin)
+            result.push_back(list.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return result;
 }
 
-template<typename It>
-void sort_small_instances(It first, It last)
+struct result
 {
-    if (std::distance(first, last) < 40)
+    std::string engine;
+    std::string type;
+    std::string distribution;
+    std::size_t size;
+    const char* cache;
+    double ns_per_element;
+    bool sorted;
+};
+
+class reporter
+{
+public:
+    explicit reporter(bool json)
+        : json_(json)
     {
-        insertion_sort(first, last);
-        return;
+        if (json_)
+            std::cout << "[\n";
+        else
+            std::cout << "engine,type,distribution,size,cache,ns_per_element,melements_per_second,sorted\n";
+    }
+
+    reporter(const reporter&) = delete;
+    reporter& operator=(const reporter&) = delete;
+
+    ~reporter()
+    {
+        if (json_)
+            std::cout << "\n]\n";
+    }
+
+    void add(const result& r)
+    {
+        const auto throughput = 1e3 / r.ns_per_element;
+        if (json_)
+        {
+            std::cout << (first_ ? "" : ",\n")
+                      << "  {\"engine\": \"" << r.engine << "\", \"type\": \"" << r.type
+                      << "\", \"distribution\": \"" << r.distribution << "\", \"size\": " << r.size
+                      << ", \"cache\": \"" << r.cache << "\", \"ns_per_element\": " << r.ns_per_element
+                      << ", \"melements_per_second\": " << throughput
+                      << ", \"sorted\": " << (r.sorted ? "true" : "false") << "}";
+        }
+        else
+        {
+            std::cout << r.engine << ',' << r.type << ',' << r.distribution << ',' << r.size << ','
+                      << r.cache << ',' << r.ns_per_element << ',' << throughput << ','
+                      << (r.sorted ? "true" : "false") << '\n';
+        }
+        std::cout.flush();
+        first_ = false;
     }
+
+private:
+    bool json_;
+    bool first_ = true;
+};
+
+// Evicts the input from the caches by streaming over a larger buffer.
+inline void flush_caches()
+{
+    static std::vector<unsigned char> buffer(std::size_t(64) << 20);
+    for (std::size_t i = 0; i < buffer.size(); i += 64)
+        ++buffer[i];
 }
 
-} // namespace detail
+// Median wall time of repeat runs on fresh copies of input, in ns.
+template<typename T>
+double measure(const engine<T>& e, const std::vector<T>& input, std::vector<T>& work, std::size_t repeat, bool cold, bool& sorted)
+{
+    std::vector<double> times;
+    for (std::size_t i = 0; i < repeat; ++i)
+    {
+        work = input;
+        if (cold)
+            flush_caches();
 
-namespace pivot
+        const auto start = std::chrono::steady_clock::now();
+        e.sort(work);
+        const auto stop = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::nano>(stop - start).count());
+    }
+    sorted = std::is_sorted(work.begin(), work.end());
+
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    return times[times.size() / 2];
+}
+
+template<typename T>
+void run_type(const std::string& type, const options& opts, reporter& out)
 {
+    const auto all = engines<T>();
+    for (const auto& name : opts.distributions)
+    {
+        for (const auto size : opts.sizes)
+        {
+            distribution ranks(name, size, 0x5eed + size);
+            std::vector<T> input(size), work;
+            for (std::size_t i = 0; i < size; ++i)
+                input[i] = make_value<T>(ranks(i));
 
-template<typename It, typename RandomGenerator>
-It random(It first, It last, RandomGenerator& g)
+            // enough repetitions for stable numbers on small inputs
+            const auto warm_repeat = opts.repeat ? opts.repeat : std::max<std::size_t>(3, std::min<std::size_t>(200, 10000000 / std::max<std::size_t>(size, 1)));
+            const auto cold_repeat = opts.repeat ? opts.repeat : 3;
+
+            for (const auto& e : all)
+            {
+                if (!opts.engines.empty() && std::find(opts.engines.begin(), opts.engines.end(), e.name) == opts.engines.end())
+                    continue;
+
+                bool sorted = false;
+                const auto warm = measure(e, input, work, warm_repeat, false, sorted);
+                out.add({e.name, type, name, size, "warm", warm / std::max<std::size_t>(size, 1), sorted});
+                const auto cold = measure(e, input, work, cold_repeat, true, sorted);
+                out.add({e.name, type, name, size, "cold", cold / std::max<std::size_t>(size, 1), sorted});
+            }
+        }
+    }
+}
+
+inline int run(int argc, char* argv[])
 {
-    std::uniform_int_distribution<> dis(0, std::distance(first, last) - 1);
-    std::advance(first, dis(g));
-    return first;
+    options opts;
+    for (int i = 0; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const auto eq = arg.find('=');
+        const auto key = arg.substr(0, eq);
+        const auto value = eq == std::string::npos ? std::string() : arg.substr(eq + 1);
+
+        if (key == "--sizes")
+        {
+            // accepts scientific notation, e.g. 1e9
+            opts.sizes.clear();
+            for (const auto& size : split_list(value))
+                opts.sizes.push_back(static_cast<std::size_t>(std::strtod(size.c_str(), nullptr)));
+        }
+        else if (key == "--distributions")
+            opts.distributions = split_list(value);
+        else if (key == "--types")
+            opts.types = split_list(value);
+        else if (key == "--engines")
+            opts.engines = split_list(value);
+        else if (key == "--repeat")
+            opts.repeat = std::strtoul(value.c_str(), nullptr, 10);
+        else if (key == "--format" && (value == "csv" || value == "json"))
+            opts.json = value == "json";
+        else
+        {
+            std::cerr << "usage: --bench [--sizes=1e3,1e6] [--distributions=random,sorted,reversed,few_unique,organ_pipe,zipf,median3_killer]\n"
+                         "               [--types=int32,int64,double,string,record64] [--engines=std_sort,sequential,...]\n"
+                         "               [--repeat=n] [--format=csv|json]\n";
+            return 2;
+        }
+    }
+
+    try
+    {
+        reporter out(opts.json);
+        for (const auto& type : opts.types)
+        {
+            if (type == "int32")
+                run_type<std::int32_t>(type, opts, out);
+            else if (type == "int64")
+                run_type<std::int64_t>(type, opts, out);
+            else if (type == "double")
+                run_type<double>(type, opts, out);
+            else if (type == "string")
+                run_type<std::string>(type, opts, out);
+            else if (type == "record64")
+                run_type<record64>(type, opts, out);
+            else
+                throw std::invalid_argument("unknown type " + type);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 2;
+    }
+    return 0;
 }
 
-template<typename It>
-It random(It first, It last)
+} // namespace bench
+
+#define TEST_ALGORITHM(NAME)                                                    \
+template<class I>                                                               \
+void test_ ## NAME (I first, I last)                                            \
+{                                                                               \
+    std::for_each(first, last, [](auto t) {                                     \
+        NAME ## _quicksort(begin(t), end(t));                                   \
+        std::cout << std::boolalpha << std::is_sorted(begin(t), end(t)) << ","; \
+    });                                                                         \
+    std::cout << "\n";                                                          \
+}
+
+// Same as TEST_ALGORITHM, passing the trailing arguments to the sort.
+// Inside them It names the iterator type of the input.
+#define TEST_VARIANT(NAME, VARIANT, ...)                                        \
+template<class I>                                                               \
+void test_ ## NAME ## _ ## VARIANT (I first, I last)                            \
+{                                                                               \
+    std::for_each(first, last, [](auto t) {                                     \
+        using It [[maybe_unused]] = decltype(begin(t));                         \
+        NAME ## _quicksort(begin(t), end(t), __VA_ARGS__);                      \
+        std::cout << std::boolalpha << std::is_sorted(begin(t), end(t)) << ","; \
+    });                                                                         \
+    std::cout << "\n";                                                          \
+}
+
+// Same as TEST_ALGORITHM for sorts whose name does not end in _quicksort.
+#define TEST_SORT(NAME)                                                         \
+template<class I>                                                               \
+void test_ ## NAME (I first, I last)                                            \
+{                                                                               \
+    std::for_each(first, last, [](auto t) {                                     \
+        NAME(begin(t), end(t));                                                 \
+        std::cout << std::boolalpha << std::is_sorted(begin(t), end(t)) << ","; \
+    });                                                                         \
+    std::cout << "\n";                                                          \
+}
+
+TEST_ALGORITHM(sequential)
+TEST_ALGORITHM(introsort)
+TEST_ALGORITHM(dual_pivot)
+TEST_ALGORITHM(triple_pivot)
+TEST_ALGORITHM(naive_parallel)
+TEST_ALGORITHM(pool_parallel)
+
+TEST_SORT(parallel_samplesort)
+TEST_SORT(radix_sort)
+TEST_SORT(parallel_radix_sort)
+TEST_SORT(parallel_multiway_mergesort)
+TEST_SORT(parallel_stable_sort)
+
+
+TEST_VARIANT(sequential, three_way, pivot::random<It>, std::less<>(), partition::three_way())
+TEST_VARIANT(pool_parallel, three_way, pivot::random<It>, std::less<>(), partition::three_way())
+TEST_VARIANT(sequential, block, pivot::random<It>, std::less<>(), partition::block())
+TEST_VARIANT(pool_parallel, block, pivot::random<It>, std::less<>(), partition::block())
+TEST_VARIANT(sequential, median_of_three, pivot::median_of_three())
+TEST_VARIANT(sequential, ninther, pivot::ninther())
+TEST_VARIANT(introsort, sample_median, pivot::sample_median(9))
+TEST_VARIANT(sequential, projection, [](int x) { return -x; }, std::greater<>())
+TEST_VARIANT(cached_key, identity, detail::identity())
+
+// Merges runs of unequal length, two of them empty, with keys repeated
+// across runs, through kway_merge and through parallel_kway_merge on a pool
+// of four. Both must give what merging the runs one by one with std::merge
+// gives, which takes equal keys from earlier runs first.
+void test_kway_merge()
 {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    return random(first, last, gen);
+    struct record
+    {
+        int key;
+        int payload;
+        bool operator==(const record& other) const { return key == other.key && payload == other.payload; }
+    };
+    auto by_key = [](const record& a, const record& b) { return a.key < b.key; };
+
+    parallel::thread_pool pool(4);
+    std::mt19937 rng(16);
+    auto lengths = std::vector<std::size_t>{30000, 0, 1, 50000, 0, 12345, 7};
+    auto runs = std::vector<std::vector<record>>();
+    for (std::size_t i = 0; i < lengths.size(); ++i)
+    {
+        auto run = std::vector<record>(lengths[i]);
+        for (std::size_t j = 0; j < run.size(); ++j)
+            run[j] = {static_cast<int>(rng() % 50), static_cast<int>(i * 1000000 + j)};
+        std::stable_sort(run.begin(), run.end(), by_key);
+        runs.push_back(std::move(run));
+    }
+
+    using It = std::vector<record>::const_iterator;
+    auto ranges = std::vector<std::pair<It, It>>();
+    auto expected = std::vector<record>();
+    for (const auto& run : runs)
+    {
+        ranges.emplace_back(run.cbegin(), run.cend());
+        auto merged = std::vector<record>(expected.size() + run.size());
+        std::merge(expected.begin(), expected.end(), run.begin(), run.end(), merged.begin(), by_key);
+        expected = std::move(merged);
+    }
+
+    auto sequential = std::vector<record>(expected.size());
+    auto pooled = std::vector<record>(expected.size());
+    const auto sequential_end = kway_merge(ranges, sequential.begin(), by_key);
+    const auto pooled_end = parallel_kway_merge(ranges, pooled.begin(), pool, by_key);
+
+    auto unsorted = std::vector<record>();
+    for (const auto& run : runs)
+        unsorted.insert(unsorted.end(), run.begin(), run.end());
+    std::shuffle(unsorted.begin(), unsorted.end(), rng);
+    auto stable = unsorted;
+    std::stable_sort(stable.begin(), stable.end(), by_key);
+    parallel_multiway_mergesort(unsorted.begin(), unsorted.end(), pool, by_key);
+
+    std::cout << std::boolalpha
+        << (sequential == expected && sequential_end == sequential.end()) << ","
+        << (pooled == expected && pooled_end == pooled.end()) << ","
+        << (unsorted == stable) << ",\n";
 }
 
-template<typename It>
-It median(It first, It last)
+// Records with few distinct keys, tagged with their input position, sorted
+// by key on a pool of four must come out exactly as std::stable_sort gives
+// them. The second run reuses the scratch of the first, which must not be
+// reallocated.
+void test_parallel_stable_sort_records()
 {
-    return std::next(first, std::distance(first,last)/2);
+    struct record
+    {
+        int key;
+        int payload;
+        bool operator==(const record& other) const { return key == other.key && payload == other.payload; }
+    };
+    auto by_key = [](const record& a, const record& b) { return a.key < b.key; };
+
+    parallel::thread_pool pool(4);
+    auto input = std::vector<record>(100000);
+    std::mt19937 rng(17);
+    for (std::size_t i = 0; i < input.size(); ++i)
+        input[i] = {static_cast<int>(rng() % 100), static_cast<int>(i)};
+
+    auto expected = input;
+    std::stable_sort(expected.begin(), expected.end(), by_key);
+
+    std::vector<record> scratch;
+    auto first = input;
+    parallel_stable_sort(first.begin(), first.end(), scratch, pool, by_key);
+    const auto capacity = scratch.capacity();
+    const auto data = scratch.data();
+
+    auto second = input;
+    std::reverse(second.begin(), second.end());
+    auto expected_second = second;
+    std::stable_sort(expected_second.begin(), expected_second.end(), by_key);
+    parallel_stable_sort(second.begin(), second.end(), scratch, pool, by_key);
+
+    std::cout << std::boolalpha
+        << (first == expected) << ","
+        << (second == expected_second && scratch.capacity() == capacity && scratch.data() == data) << ",\n";
 }
 
-} // namespace selector
+// Whether the policy front-end takes these arguments for a vector<int>.
+template<typename Cmp, typename Pivot_func, typename = void>
+constexpr bool front_end_accepts = false;
 
-template<typename BiIt,
-         typename Pivot_func = decltype(pivot::random<BiIt>),
-         typename Cmp = std::less<>>
-void sequential_quicksort(BiIt first, BiIt last, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{})
+template<typename Cmp, typename Pivot_func>
+constexpr bool front_end_accepts<Cmp, Pivot_func, std::void_t<decltype(quicksort(execution::seq,
+    std::declval<std::vector<int>::iterator>(), std::declval<std::vector<int>::iterator>(),
+    std::declval<Cmp>(), detail::identity(), std::declval<Pivot_func>()))>> = true;
+
+static_assert(front_end_accepts<std::less<>, pivot::ninther>
+              && !front_end_accepts<std::less<>, int>
+              && !front_end_accepts<std::less<std::string>, pivot::ninther>,
+              "the policy front-end must reject pivots and comparators that do not fit at the call");
+
+#if defined(__cpp_lib_ranges) && defined(__cpp_lib_concepts)
+template<typename Pivot_func>
+concept ranges_front_end_accepts = requires(std::vector<int>& v, Pivot_func pivot_func) {
+    ranges::quicksort(v, std::ranges::less(), std::identity(), pivot_func);
+};
+
+static_assert(ranges_front_end_accepts<pivot::ninther> && !ranges_front_end_accepts<int>,
+              "the ranges front-end must reject pivots that do not fit at the call");
+#endif
+
+// The execution-policy front-end with each policy, with a pivot policy and
+// partition scheme of its own, and in C++20 the ranges one on a whole
+// container, with a projection and with a pivot policy, against std::sort.
+template<class I>
+void test_policy_front_end(I first, I last)
 {
-    if (std::distance(first, last) < 2)
-        return;
+    std::for_each(first, last, [](const auto& t) {
+        auto expected = t, descending = t;
+        std::sort(expected.begin(), expected.end());
+        std::sort(descending.begin(), descending.end(), std::greater<>());
 
-    //detail::sort_small_instances(first, last); // optimization
+        auto seq = t, par = t, par_unseq = t, projected = t;
+        quicksort(execution::seq, seq.begin(), seq.end());
+        quicksort(execution::par, par.begin(), par.end());
+        quicksort(execution::par_unseq, par_unseq.begin(), par_unseq.end());
+        quicksort(execution::par, projected.begin(), projected.end(), std::less<>(), [](int x) { return -x; });
+        auto engine = t;
+        quicksort(execution::par, engine.begin(), engine.end(), std::less<>(), detail::identity(), pivot::median_of_three(), partition::three_way());
+        auto ok = seq == expected && par == expected && par_unseq == expected && projected == descending && engine == expected;
 
-    auto pivot = pivot_func(first, last);
-    auto pivot_value = *pivot;
-    std::iter_swap(first, pivot);
+#if defined(__cpp_lib_ranges) && defined(__cpp_lib_concepts)
+        auto range = t, range_projected = t, range_engine = t;
+        const auto end = ranges::quicksort(range);
+        ranges::quicksort(range_projected, {}, [](int x) { return -x; });
+        ranges::quicksort(execution::par, range_engine, std::ranges::greater(), std::identity(), pivot::ninther(), partition::block());
+        ok = ok && range == expected && end == range.end() && range_projected == descending && range_engine == descending;
+#endif
+        std::cout << std::boolalpha << ok << ",";
+    });
+    std::cout << "\n";
+}
+
+// Inputs of twice samplesort_threshold elements for the parallel engines
+// that leave smaller ranges to a sequential sort: random, few distinct keys
+// including negative ones, sorted and reversed.
+std::vector<std::vector<int>> large_inputs()
+{
+    const auto size = static_cast<std::size_t>(detail::samplesort_threshold) * 2;
+    auto random = std::vector<int>(size);
+    helpers::insert_random_ints(random);
+
+    auto few_distinct = std::vector<int>(size);
+    std::mt19937 rng(10);
+    for (auto& x : few_distinct)
+        x = static_cast<int>(rng() % 5) - 2;
+
+    auto sorted = random;
+    std::sort(sorted.begin(), sorted.end());
+    return {random, few_distinct, sorted, std::vector<int>(sorted.rbegin(), sorted.rend())};
+}
+
+// parallel_samplesort on a pool of four, so the parallel classification and
+// scatter run however many cores the machine has.
+void test_parallel_samplesort_pool()
+{
+    parallel::thread_pool pool(4);
+    for (const auto& input : large_inputs())
+    {
+        auto v = input, expected = input;
+        parallel_samplesort(v.begin(), v.end(), pool);
+        std::sort(expected.begin(), expected.end());
+        std::cout << std::boolalpha << (v == expected) << ",";
+    }
+    std::cout << "\n";
+}
+
+// With few distinct keys the splitters repeat, so every key but possibly
+// the largest, which need not be drawn as a splitter, must land in an
+// equality bucket that samplesort leaves unsorted, rather than all of them
+// in one bucket a single worker sorts. Distinct keys get no equality buckets.
+void test_splitter_tree_equal_buckets()
+{
+    using It = std::vector<int>::iterator;
+    auto less = std::less<>();
+    auto few_distinct = std::vector<int>(1 << 16);
+    std::mt19937 rng(11);
+    for (auto& x : few_distinct)
+        x = static_cast<int>(rng() % 4);
+    auto distinct = std::vector<int>(1 << 16);
+    helpers::insert_random_ints(distinct);
+
+    const detail::splitter_tree<It, std::less<>> repeated(detail::draw_splitters(few_distinct.begin(), few_distinct.end(), 16, less), less);
+    const detail::splitter_tree<It, std::less<>> unique(detail::draw_splitters(distinct.begin(), distinct.end(), 16, less), less);
+
+    std::cout << std::boolalpha
+        << (repeated.buckets() == 31 && std::all_of(few_distinct.begin(), few_distinct.end(), [&](int x) {
+               return repeated.is_equal_bucket(repeated.classify(x)) || x == 3;
+           })) << ","
+        << (unique.buckets() == 16 && !unique.is_equal_bucket(unique.classify(distinct.front()))) << ",\n";
+}
+
+// Move-only elements through both samplesorts, which must never copy one.
+void test_samplesort_move_only()
+{
+    parallel::thread_pool pool(4);
+    const numa::node_pools pools(numa::topology{{{0, 1}, {2, 3}}});
+    auto by_value = [](const std::unique_ptr<int>& a, const std::unique_ptr<int>& b) { return *a < *b; };
+
+    for (const auto& input : large_inputs())
+    {
+        auto pooled = std::vector<std::unique_ptr<int>>(), nodes = std::vector<std::unique_ptr<int>>();
+        for (auto x : input)
+        {
+            pooled.push_back(std::make_unique<int>(x));
+            nodes.push_back(std::make_unique<int>(x));
+        }
+        auto expected = input;
+        std::sort(expected.begin(), expected.end());
+
+        parallel_samplesort(pooled.begin(), pooled.end(), pool, by_value);
+        numa_samplesort(nodes.begin(), nodes.end(), pools, by_value);
+        auto matches = [&expected](const std::vector<std::unique_ptr<int>>& v) {
+            return std::equal(v.begin(), v.end(), expected.begin(), expected.end(), [](const std::unique_ptr<int>& p, int x) { return *p == x; });
+        };
+        std::cout << std::boolalpha << (matches(pooled) && matches(nodes)) << ",";
+    }
+    std::cout << "\n";
+}
+
+// parallel_radix_sort on a pool of four, with float keys as well, so the
+// parallel histogram and scatter run however many cores the machine has.
+// The int inputs share one caller-owned scratch, which must not be
+// reallocated after the first of them.
+void test_parallel_radix_sort_pool()
+{
+    parallel::thread_pool pool(4);
+    std::vector<int> scratch;
+    const int* scratch_data = nullptr;
+    for (const auto& input : large_inputs())
+    {
+        auto v = input, expected = input;
+        parallel_radix_sort(v.begin(), v.end(), scratch, pool);
+        std::sort(expected.begin(), expected.end());
+        const auto reused = !scratch_data || scratch.data() == scratch_data;
+        scratch_data = scratch.data();
+
+        auto floats = std::vector<float>(input.begin(), input.end());
+        for (auto& x : floats)
+            x = x / 4.0f - 3.5f;
+        auto expected_floats = floats;
+        parallel_radix_sort(floats.begin(), floats.end(), pool);
+        std::sort(expected_floats.begin(), expected_floats.end());
+        std::cout << std::boolalpha << (v == expected && reused && floats == expected_floats) << ",";
+    }
+    std::cout << "\n";
+}
+
+// Sorts a copy of the inputs in one batch_sort call.
+template<class I>
+void test_batch_sort(I first, I last)
+{
+    auto batch = std::vector<typename std::iterator_traits<I>::value_type>(first, last);
+    batch_sort(batch);
+    for (const auto& t : batch)
+        std::cout << std::boolalpha << std::is_sorted(begin(t), end(t)) << ",";
+    std::cout << "\n";
+}
 
-    auto greater_than_pivot = std::partition(std::next(first), last, [pivot_value, cmp](const auto& val) {
-        return cmp(val, pivot_value);
+// Sorts each input as a std::list and a std::forward_list, through the
+// engine for ranges without random access, sequentially and from the
+// parallel engines, which finish their subranges with it.
+template<class I>
+void test_sequential_list(I first, I last)
+{
+    std::for_each(first, last, [](const auto& t) {
+        using value_type = typename std::decay_t<decltype(t)>::value_type;
+        const auto list = std::list<value_type>(begin(t), end(t));
+        auto sequential = list, naive = list, pooled = list;
+        auto forward = std::forward_list<value_type>(begin(t), end(t));
+        sequential_quicksort(sequential.begin(), sequential.end());
+        naive_parallel_quicksort(naive.begin(), naive.end());
+        pool_parallel_quicksort(pooled.begin(), pooled.end());
+        sequential_quicksort(forward.begin(), forward.end());
+        std::cout << std::boolalpha << (std::is_sorted(sequential.begin(), sequential.end())
+            && naive == sequential && pooled == sequential
+            && std::equal(forward.begin(), forward.end(), sequential.begin(), sequential.end())) << ",";
     });
+    std::cout << "\n";
+}
 
-    std::iter_swap(std::prev(greater_than_pivot), first);
+// Pivots handed to the engine for ranges without random access must be the
+// ones it partitions around: pivot::median on a sorted list, and a pivot
+// that counts its calls.
+std::size_t list_pivot_calls = 0;
 
-    sequential_quicksort(first, std::prev(greater_than_pivot), pivot_func, cmp);
-    sequential_quicksort(greater_than_pivot, last, pivot_func, cmp);
+template<class It>
+It counted_median(It first, It last)
+{
+    ++list_pivot_calls;
+    return pivot::median(first, last);
 }
 
-template<typename BiIt,
-         typename Pivot_func = decltype(pivot::random<BiIt>),
-         typename Cmp = std::less<>>
-void naive_parallel_quicksort(BiIt first, BiIt last, int depth = 0, Pivot_func pivot_func = pivot::random, Cmp cmp = Cmp{})
+void test_sequential_list_pivot()
 {
-    if (std::distance(first, last) < 2)
-        return;
+    using It = std::list<int>::iterator;
+    auto values = std::vector<int>(1000);
+    helpers::insert_random_ints(values);
 
-    //detail::sort_small_instances(first, last); // optimization
+    auto sorted = std::list<int>(values.size());
+    std::iota(sorted.begin(), sorted.end(), 0);
+    sequential_quicksort(sorted.begin(), sorted.end(), pivot::median<It>);
 
-    auto pivot = pivot_func(first, last);
-    auto pivot_value = *pivot;
-    std::iter_swap(first, pivot);
+    auto counted = std::list<int>(values.begin(), values.end());
+    sequential_quicksort(counted.begin(), counted.end(), counted_median<It>);
+
+    std::cout << std::boolalpha
+        << (std::is_sorted(sorted.begin(), sorted.end()) && std::is_sorted(counted.begin(), counted.end())
+            && list_pivot_calls > 0) << ",\n";
+}
+
+// Sorts each input as a key column with its original positions as payload
+// column, and again on a pool of four in descending order with a second
+// payload column of the positions as text. Every payload must still name
+// the position its key came from.
+template<class I>
+void test_sort_by_key(I first, I last)
+{
+    parallel::thread_pool pool(4);
+    std::for_each(first, last, [&pool](const auto& original) {
+        auto paired = [&original](const auto& keys, const auto& positions) {
+            for (std::size_t i = 0; i < keys.size(); ++i)
+                if (keys[i] != original[positions[i]])
+                    return false;
+            return true;
+        };
 
-    auto greater_than_pivot = std::partition(std::next(first), last, [pivot_value, cmp](const auto& val) {
-        return cmp(val, pivot_value);
+        auto keys = original;
+        auto positions = std::vector<std::size_t>(original.size());
+        std::iota(positions.begin(), positions.end(), std::size_t{0});
+        sort_by_key(keys.begin(), keys.end(), positions.begin());
+        auto ok = std::is_sorted(keys.begin(), keys.end()) && paired(keys, positions);
+
+        auto descending = original;
+        auto pooled_positions = std::vector<std::size_t>(original.size());
+        std::iota(pooled_positions.begin(), pooled_positions.end(), std::size_t{0});
+        auto names = std::vector<std::string>(original.size());
+        for (std::size_t i = 0; i < names.size(); ++i)
+            names[i] = std::to_string(i);
+        sort_by_key(pool, std::greater<>(), descending.begin(), descending.end(), pooled_positions.begin(), names.begin());
+        ok = ok && std::is_sorted(descending.begin(), descending.end(), std::greater<>()) && paired(descending, pooled_positions);
+        for (std::size_t i = 0; i < names.size(); ++i)
+            ok = ok && names[i] == std::to_string(pooled_positions[i]);
+
+        std::cout << std::boolalpha << ok << ",";
+    });
+    std::cout << "\n";
+}
+
+// Positions to select or sort up to in t: both ends, a prefix small enough
+// for parallel_partial_quicksort to work on slices, and a third.
+template<class T>
+std::vector<std::size_t> selection_points(const T& t)
+{
+    return {0, std::min<std::size_t>(t.size(), 100), t.size() / 3, t.size()};
+}
+
+// Checks quickselect against std::nth_element; the rest of the range must
+// keep its elements and lie on the right side of nth.
+template<class I>
+void test_quickselect(I first, I last)
+{
+    std::for_each(first, last, [](const auto& t) {
+        auto ok = true;
+        for (auto n : selection_points(t))
+        {
+            auto v = t, expected = t;
+            quickselect(v.begin(), v.begin() + n, v.end());
+            std::nth_element(expected.begin(), expected.begin() + n, expected.end());
+            if (n < t.size())
+            {
+                ok = ok && v[n] == expected[n]
+                    && std::all_of(v.begin(), v.begin() + n, [&](int x) { return !(v[n] < x); })
+                    && std::all_of(v.begin() + n, v.end(), [&](int x) { return !(x < v[n]); });
+            }
+            std::sort(v.begin(), v.end());
+            std::sort(expected.begin(), expected.end());
+            ok = ok && v == expected;
+        }
+        std::cout << std::boolalpha << ok << ",";
+    });
+    std::cout << "\n";
+}
+
+// Checks partial_quicksort, and parallel_partial_quicksort on a pool of
+// four, against std::partial_sort, including the empty and the full prefix.
+template<class I>
+void test_partial_quicksort(I first, I last)
+{
+    parallel::thread_pool pool(4);
+    std::for_each(first, last, [&pool](const auto& t) {
+        auto ok = true;
+        for (auto n : selection_points(t))
+        {
+            auto sequential = t, pooled = t, expected = t;
+            partial_quicksort(sequential.begin(), sequential.begin() + n, sequential.end());
+            parallel_partial_quicksort(pooled.begin(), pooled.begin() + n, pooled.end(), pool);
+            std::partial_sort(expected.begin(), expected.begin() + n, expected.end());
+            ok = ok && std::equal(expected.begin(), expected.begin() + n, sequential.begin())
+                && std::equal(expected.begin(), expected.begin() + n, pooled.begin());
+            std::sort(sequential.begin(), sequential.end());
+            std::sort(pooled.begin(), pooled.end());
+            std::sort(expected.begin(), expected.end());
+            ok = ok && sequential == expected && pooled == expected;
+        }
+        std::cout << std::boolalpha << ok << ",";
     });
+    std::cout << "\n";
+}
+
+// The counting comparator on fixed inputs: sorted and reversed ones go
+// through the pre-pass alone, one comparison per element and no partition
+// step; a random one stays within the expected bounds of a quicksort, also
+// through the dual-pivot engine, and has its steps timed per level up to
+// the depth reached. A list of equal keys is one gather in the forward
+// engine, which must report its swaps.
+void test_counting()
+{
+    using It = std::vector<int>::iterator;
+    constexpr std::uint64_t n = 1000;
+    auto sort_counted = [](std::vector<int> v) {
+        instrument::collector sink;
+        sequential_quicksort(v.begin(), v.end(), pivot::random<It>, instrument::counting<>(sink));
+        return std::make_pair(std::is_sorted(v.begin(), v.end()), sink.snapshot());
+    };
 
-    std::iter_swap(std::prev(greater_than_pivot), first);
+    auto sorted = std::vector<int>(n);
+    std::iota(sorted.begin(), sorted.end(), 0);
+    auto random = sorted;
+    std::shuffle(random.begin(), random.end(), std::mt19937(42));
 
-    if (depth < 5)
+    const auto ascending = sort_counted(sorted);
+    const auto descending = sort_counted(std::vector<int>(sorted.rbegin(), sorted.rend()));
+    const auto shuffled = sort_counted(random);
+    const auto steps = std::accumulate(shuffled.second.balance.begin(), shuffled.second.balance.end(), std::uint64_t{0});
+
+    const auto& timed = shuffled.second.nanoseconds;
+    const auto timed_levels = static_cast<std::ptrdiff_t>(shuffled.second.max_depth) + 1;
+
+    instrument::collector list_sink;
+    auto equal_keys = std::list<int>(n, 7);
+    sequential_quicksort(equal_keys.begin(), equal_keys.end(), pivot::random<std::list<int>::iterator>, instrument::counting<>(list_sink));
+    const auto list_stats = list_sink.snapshot();
+
+    instrument::collector dual_sink;
+    auto dual = random;
+    dual_pivot_quicksort(dual.begin(), dual.end(), pivot::random<It>, instrument::counting<>(dual_sink));
+    const auto dual_stats = dual_sink.snapshot();
+    const auto dual_steps = std::accumulate(dual_stats.balance.begin(), dual_stats.balance.end(), std::uint64_t{0});
+
+    std::cout << std::boolalpha
+        << (ascending.first && ascending.second.comparisons == n && ascending.second.swaps == 0
+            && ascending.second.moves == 0 && ascending.second.partitions == 0) << ","
+        << (descending.first && descending.second.comparisons == n && descending.second.swaps == n / 2
+            && descending.second.moves == 0 && descending.second.partitions == 0) << ","
+        << (shuffled.first && shuffled.second.comparisons >= n - 1 && shuffled.second.comparisons <= 2 * n * 10
+            && shuffled.second.partitions > 0 && steps == shuffled.second.partitions
+            && shuffled.second.max_depth <= 4 * 10) << ","
+        << (std::is_sorted(dual.begin(), dual.end()) && dual_stats.comparisons <= 2 * n * 10
+            && dual_stats.partitions > 0 && dual_steps == dual_stats.partitions && dual_stats.swaps > 0
+            && dual_stats.max_depth > 0 && dual_stats.max_depth <= 4 * 10) << ","
+        << (std::accumulate(timed.begin(), timed.begin() + timed_levels, std::uint64_t{0}) > 0
+            && std::all_of(timed.begin() + timed_levels, timed.end(), [](std::uint64_t t) { return t == 0; })) << ","
+        << (list_stats.partitions == 1 && list_stats.swaps == n - 1) << ",\n";
+}
+
+#if QUICKSORT_HAS_MMAP
+// External sort of a temporary file with a budget of a single page of
+// records, so it is cut into several runs that are merged over the
+// temporary output. Every payload must still belong to its key.
+void test_external_sort()
+{
+    struct record
     {
-        std::thread t1([=]() {
-            naive_parallel_quicksort(first, std::prev(greater_than_pivot), depth+1, pivot_func, cmp);
-        });
+        std::uint32_t key;
+        std::uint32_t payload;
+    };
+    auto payload_of = [](std::uint32_t key) { return key * 2654435761u; };
 
-        naive_parallel_quicksort(greater_than_pivot, last, depth+1, pivot_func, cmp);
-        t1.join();
+    auto records = std::vector<record>(20000);
+    std::mt19937 rng(7);
+    for (auto& r : records)
+    {
+        r.key = rng() % 5000;
+        r.payload = payload_of(r.key);
     }
-    else
+
+    const auto directory = std::getenv("TMPDIR") ? std::string(std::getenv("TMPDIR")) : std::string("/tmp");
+    auto path = directory + "/quicksort_external_XXXXXX";
+    const auto fd = ::mkstemp(&path[0]);
+    if (fd < 0)
     {
-        naive_parallel_quicksort(first, std::prev(greater_than_pivot), depth+1, pivot_func, cmp);
-        naive_parallel_quicksort(greater_than_pivot, last, depth+1, pivot_func, cmp);
+        std::cout << "false,\n";
+        return;
     }
+    ::close(fd);
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(record));
+
+    external::options opts;
+    opts.memory_budget = 1;
+    opts.write_buffer = 4096;
+    auto by_key = [](const record& a, const record& b) { return a.key < b.key; };
+    external::external_sort<record>(path, opts, by_key);
+
+    auto sorted = std::vector<record>(records.size() + 1);
+    std::ifstream in(path, std::ios::binary);
+    in.read(reinterpret_cast<char*>(sorted.data()), sorted.size() * sizeof(record));
+    sorted.resize(static_cast<std::size_t>(in.gcount()) / sizeof(record));
+    in.close();
+    std::remove(path.c_str());
+
+    std::stable_sort(records.begin(), records.end(), by_key);
+    std::cout << std::boolalpha
+        << (sorted.size() == records.size() && std::is_sorted(sorted.begin(), sorted.end(), by_key)
+            && std::equal(sorted.begin(), sorted.end(), records.begin(), [](const record& a, const record& b) { return a.key == b.key; })
+            && std::all_of(sorted.begin(), sorted.end(), [&](const record& r) { return r.payload == payload_of(r.key); })) << ",\n";
 }
+#endif
 
-namespace helpers
+// numa_samplesort on node pools built from a made-up layout of two and of
+// three nodes, so the node-local gather and the move back run on any
+// machine; CPUs the machine lacks just leave their workers unpinned.
+void test_numa_samplesort()
 {
-    template <class C>
-    void insert_random_ints(C& c)
+    const auto size = static_cast<std::size_t>(detail::samplesort_threshold) * 2;
+    auto random = std::vector<int>(size);
+    helpers::insert_random_ints(random);
+    auto few_distinct = std::vector<int>(size);
+    std::mt19937 rng(25);
+    for (auto& x : few_distinct)
+        x = static_cast<int>(rng() % 4);
+
+    for (const auto& layout : {numa::topology{{{0, 1}, {2, 3}}}, numa::topology{{{0}, {1, 2}, {3, 4, 5}}}})
     {
-        std::random_device rd;
-        std::mt19937 g(rd());
+        const numa::node_pools pools(layout);
+        for (const auto& input : {random, few_distinct})
+        {
+            auto v = input, expected = input;
+            numa_samplesort(v.begin(), v.end(), pools);
+            std::sort(expected.begin(), expected.end());
+            std::cout << std::boolalpha << (pools.nodes() == layout.nodes.size() && v == expected) << ",";
+        }
+    }
+    std::cout << "\n";
+}
 
-        std::iota(c.begin(), c.end(), 0);
-        std::shuffle(c.begin(), c.end(), g);
+// Reads each input through a lazy_sorted_range a few elements at a time,
+// which must give the sequence std::sort gives.
+template<class I>
+void test_lazy_sorted_range(I first, I last)
+{
+    std::for_each(first, last, [](auto t) {
+        auto expected = t;
+        std::sort(expected.begin(), expected.end());
+
+        auto range = lazy_sorted_range<typename decltype(t)::iterator>(t.begin(), t.end());
+        auto read = decltype(t){};
+        for (auto it = range.begin(); !range.done(); it = range.sorted_end())
+            read.insert(read.end(), it, range.extend(7));
+        std::cout << std::boolalpha << (read == expected) << ",";
+    });
+    std::cout << "\n";
+}
+
+// Reading the first ten of 100000 elements must only sort a prefix, with a
+// handful of linear partition passes rather than n log n comparisons.
+void test_lazy_sorted_range_prefix()
+{
+    using It = std::vector<int>::iterator;
+    auto v = std::vector<int>(100000);
+    helpers::insert_random_ints(v);
+    auto expected = v;
+    std::partial_sort(expected.begin(), expected.begin() + 10, expected.end());
+
+    instrument::collector sink;
+    auto range = lazy_sorted_range<It, decltype(pivot::random<It>), instrument::counting<>>(v.begin(), v.end(), pivot::random<It>, instrument::counting<>(sink));
+    const auto sorted_end = range.extend(10);
+    std::cout << std::boolalpha
+        << (sorted_end - v.begin() >= 10 && sorted_end - v.begin() < 1000
+            && std::equal(expected.begin(), expected.begin() + 10, v.begin())
+            && sink.snapshot().comparisons < 8 * v.size()) << ",\n";
+}
+
+// A range two_way finds already split must be reported as such, also on the
+// vector path, or split_sorted never gets to finish it early.
+void test_two_way_already_partitioned()
+{
+    auto v = std::vector<int>{500};
+    for (int i = 0; i < 1000; ++i)
+        v.push_back(i < 500 ? i : i + 1);
+
+    const auto split = partition::two_way()(v.begin(), v.end(), std::less<>());
+    std::cout << std::boolalpha << (split.already_partitioned && split.lower == v.begin() + 500 && *split.lower == 500) << ",\n";
+}
+
+// With workers = 1 the pooled sort must stay on the calling thread, however
+// large the pool.
+void test_pool_parallel_single_worker()
+{
+    parallel::thread_pool pool(8);
+    auto v = std::vector<int>(1 << 18);
+    helpers::insert_random_ints(v);
+
+    std::mutex mutex;
+    std::vector<std::thread::id> threads;
+    auto cmp = [&](int a, int b) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (std::find(threads.begin(), threads.end(), std::this_thread::get_id()) == threads.end())
+            threads.push_back(std::this_thread::get_id());
+        return a < b;
+    };
+
+    parallel::cutoff_policy policy;
+    policy.workers = 1;
+    pool_parallel_quicksort(v.begin(), v.end(), pool, pivot::random<std::vector<int>::iterator>, cmp, partition::two_way(), policy);
+    std::cout << std::boolalpha << (std::is_sorted(v.begin(), v.end()) && threads.size() == 1) << ",\n";
+}
+
+// Large enough for the top levels of pool_parallel_quicksort to partition
+// in parallel on a pool of four, with few distinct keys so most elements
+// are equal to the pivot. detail::parallel_partition is also checked on
+// its own, on the same input.
+void test_pool_parallel_partition()
+{
+    using It = std::vector<int>::iterator;
+    parallel::thread_pool pool(4);
+    auto input = std::vector<int>(detail::parallel_partition_threshold * 2);
+    std::mt19937 rng(9);
+    for (auto& x : input)
+        x = static_cast<int>(rng() % 8);
+
+    auto expected = input;
+    std::sort(expected.begin(), expected.end());
+
+    parallel::cutoff_policy policy;
+    policy.workers = 4;
+    auto two_way = input, block = input;
+    pool_parallel_quicksort(two_way.begin(), two_way.end(), pool, pivot::random<It>, std::less<>(), partition::two_way(), policy);
+    pool_parallel_quicksort(block.begin(), block.end(), pool, pivot::random<It>, std::less<>(), partition::block(), policy);
+
+    auto split = input;
+    const auto middle = detail::parallel_partition(split.begin(), split.end(), 4, std::less<>(), pool, 4);
+
+    const auto partitioned = std::all_of(split.begin(), middle, [](int x) { return x < 4; })
+        && std::all_of(middle, split.end(), [](int x) { return x >= 4; });
+    std::sort(split.begin(), split.end());
+
+    std::cout << std::boolalpha
+        << (two_way == expected) << ","
+        << (block == expected) << ","
+        << (partitioned && split == expected) << ",\n";
+}
+
+#if QUICKSORT_HAS_COROUTINES
+// Smallest coroutine type that can co_await a sort_future: starts at once,
+// never suspends at the end and hands its result over a std::promise.
+struct sort_awaiting_task
+{
+    struct promise_type
+    {
+        sort_awaiting_task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+sort_awaiting_task await_sort(parallel::sort_future future, std::promise<parallel::sort_status>& result)
+{
+    result.set_value(co_await future);
+}
+#endif
+
+// async_quicksort on a pool of four: a completed sort, one stopped before it
+// starts, one stopped from the comparator halfway through and one whose
+// comparator throws. Stopped sorts must leave a permutation of the input.
+void test_async_quicksort()
+{
+    using It = std::vector<int>::iterator;
+    parallel::thread_pool pool(4);
+    auto input = std::vector<int>(100000);
+    helpers::insert_random_ints(input);
+    auto expected = input;
+    std::sort(expected.begin(), expected.end());
+
+    auto completed = input;
+    auto future = async_quicksort(completed.begin(), completed.end(), pool);
+    const auto status = future.get();
+    std::cout << std::boolalpha
+        << (status == parallel::sort_status::completed && future.finalized() == future.size()
+            && future.size() == input.size() && completed == expected) << ",";
+
+    auto stopped_before = input;
+    parallel::stop_source before;
+    before.request_stop();
+    const auto status_before = async_quicksort(stopped_before.begin(), stopped_before.end(), pool, before.get_token()).get();
+    std::sort(stopped_before.begin(), stopped_before.end());
+    std::cout << (status_before == parallel::sort_status::cancelled && stopped_before == expected) << ",";
+
+    auto stopped_during = input;
+    parallel::stop_source during;
+    std::atomic<std::size_t> comparisons{0};
+    auto stopping = [&](int a, int b) {
+        if (comparisons.fetch_add(1, std::memory_order_relaxed) == input.size())
+            during.request_stop();
+        return a < b;
+    };
+    auto stopped = async_quicksort(stopped_during.begin(), stopped_during.end(), pool, during.get_token(), pivot::random<It>, stopping);
+    const auto status_during = stopped.get();
+    std::sort(stopped_during.begin(), stopped_during.end());
+    std::cout << (status_during == parallel::sort_status::cancelled && stopped.finalized() < stopped.size()
+                  && stopped_during == expected) << ",";
+
+    auto throwing_input = input;
+    std::atomic<std::size_t> calls{0};
+    auto throwing = [&](int a, int b) {
+        if (calls.fetch_add(1, std::memory_order_relaxed) == input.size())
+            throw std::runtime_error("comparator failed");
+        return a < b;
+    };
+    auto thrown = false;
+    try
+    {
+        async_quicksort(throwing_input.begin(), throwing_input.end(), pool, parallel::stop_token(), pivot::random<It>, throwing).get();
     }
-} // namespace helpers
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    std::cout << thrown << ",";
 
-#define TEST_ALGORITHM(NAME)                                                    \
-template<class I>                                                               \
-void test_ ## NAME (I first, I last)                                            \
-{                                                                               \
-    std::for_each(first, last, [](auto t) {                                     \
-        NAME ## _quicksort(begin(t), end(t));                                   \
-        std::cout << std::boolalpha << std::is_sorted(begin(t), end(t)) << ","; \
-    });                                                                         \
-    std::cout << "\n";                                                          \
+#if QUICKSORT_HAS_COROUTINES
+    auto awaited = input;
+    std::promise<parallel::sort_status> result;
+    await_sort(async_quicksort(awaited.begin(), awaited.end(), pool), result);
+    std::cout << (result.get_future().get() == parallel::sort_status::completed && awaited == expected) << ",";
+#endif
+    std::cout << "\n";
 }
 
-TEST_ALGORITHM(sequential)
-TEST_ALGORITHM(naive_parallel)
+static_assert(fixed_sorted(std::array<int, 6>{5, 3, 0, 4, 1, 2}).front() == 0
+              && fixed_sorted(std::array<int, 6>{5, 3, 0, 4, 1, 2}).back() == 5,
+              "fixed_sort must work in constant expressions");
 
-int main()
+int main(int argc, char* argv[])
 {
     using std::vector;
 
+    if (argc > 1 && std::string(argv[1]) == "--bench")
+        return bench::run(argc - 2, argv + 2);
+
     auto empty = vector<int> {};
     auto singleton = vector<int> {1};
     auto doubleton = vector<int> {9,4};
@@ -184,6 +6099,7 @@ int main()
     auto almost_sorted = vector<int> {0,1,2,3,5,4,6,9,8};
     auto many_unique = vector<int> {1,2,0,1,0,0,2,2,1};
     auto wave = vector<int> {1,2,3,2,1,2,3,4,5,6,7,6,5,4,3,2,1};
+    auto organ_pipe = vector<int> {0,1,2,3,4,5,5,4,3,2,1,0};
 
     auto random100 = vector<int> (100);
     helpers::insert_random_ints(random100);
@@ -191,11 +6107,58 @@ int main()
     auto random1000 = vector<int> (1000);
     helpers::insert_random_ints(random1000);
 
+    auto random100000 = vector<int> (100000);
+    helpers::insert_random_ints(random100000);
+
     auto inputs = vector<vector<int>> {empty, singleton, doubleton,
                                        random, sorted, reversed,
                                        almost_sorted, many_unique,
-                                       wave, random100, random1000};
+                                       wave, organ_pipe, random100,
+                                       random1000, random100000};
 
     test_sequential(std::begin(inputs), std::end(inputs));
+    test_introsort(std::begin(inputs), std::end(inputs));
+    test_dual_pivot(std::begin(inputs), std::end(inputs));
+    test_triple_pivot(std::begin(inputs), std::end(inputs));
     test_naive_parallel(std::begin(inputs), std::end(inputs));
+    test_pool_parallel(std::begin(inputs), std::end(inputs));
+    test_parallel_samplesort(std::begin(inputs), std::end(inputs));
+    test_parallel_samplesort_pool();
+    test_samplesort_move_only();
+    test_splitter_tree_equal_buckets();
+    test_radix_sort(std::begin(inputs), std::end(inputs));
+    test_parallel_radix_sort(std::begin(inputs), std::end(inputs));
+    test_parallel_radix_sort_pool();
+    test_parallel_multiway_mergesort(std::begin(inputs), std::end(inputs));
+    test_parallel_stable_sort(std::begin(inputs), std::end(inputs));
+
+    test_sequential_three_way(std::begin(inputs), std::end(inputs));
+    test_pool_parallel_three_way(std::begin(inputs), std::end(inputs));
+    test_sequential_block(std::begin(inputs), std::end(inputs));
+    test_pool_parallel_block(std::begin(inputs), std::end(inputs));
+    test_sequential_median_of_three(std::begin(inputs), std::end(inputs));
+    test_sequential_ninther(std::begin(inputs), std::end(inputs));
+    test_introsort_sample_median(std::begin(inputs), std::end(inputs));
+    test_sequential_projection(std::begin(inputs), std::end(inputs));
+    test_cached_key_identity(std::begin(inputs), std::end(inputs));
+    test_policy_front_end(std::begin(inputs), std::end(inputs));
+    test_batch_sort(std::begin(inputs), std::end(inputs));
+    test_sequential_list(std::begin(inputs), std::end(inputs));
+    test_sequential_list_pivot();
+    test_sort_by_key(std::begin(inputs), std::end(inputs));
+    test_quickselect(std::begin(inputs), std::end(inputs));
+    test_partial_quicksort(std::begin(inputs), std::end(inputs));
+    test_kway_merge();
+    test_parallel_stable_sort_records();
+    test_counting();
+    test_numa_samplesort();
+    test_lazy_sorted_range(std::begin(inputs), std::end(inputs));
+    test_lazy_sorted_range_prefix();
+#if QUICKSORT_HAS_MMAP
+    test_external_sort();
+#endif
+    test_pool_parallel_single_worker();
+    test_pool_parallel_partition();
+    test_async_quicksort();
+    test_two_way_already_partitioned();
 }